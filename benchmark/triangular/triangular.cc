@@ -0,0 +1,104 @@
+/*Compares the scalar triangular inverse used before by gplib against the
+LAPACK backed kernels of basic.hpp. Prints one line per size with the time
+in seconds of each method:
+
+  d, scalar_inverse, trtri_inverse, inverse_solve, trtrs_solve,
+  copy_vec_solve, trans_vec_solve
+
+The last two time 100 solves R' * x = b with a single right hand side, the
+first one transposing a copy of R as gplib did before and the second one
+with triangular_solve, which reads R' in place.
+
+Usage: ./triangular.mio [max_d]*/
+
+#include <gplib/gplib.hpp>
+#include <armadillo>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace arma;
+
+// Copy of the scalar loop that gplib::upper_triangular_inverse used to run.
+mat scalar_upper_triangular_inverse(const mat &upper_t) {
+  size_t d = upper_t.n_rows;
+  mat ans(d, d);
+  ans.fill(0.0);
+  vector<double> tmp(d);
+  for (size_t i = 0; i < d; i++) {
+    ans(i, i) = 1.0 / upper_t(i, i);
+    for (size_t j = i + 1; j < d; j++)
+      tmp[j] = upper_t(i, j) / upper_t(i, i);
+    for (size_t j = i + 1; j < d; j++) {
+      double factor = ans(i, j) = -tmp[j] / upper_t(j, j);
+      for (size_t k = j + 1; k < d; k++)
+        tmp[k] += factor * upper_t(j, k);
+    }
+  }
+  return ans;
+}
+
+template<typename F>
+double seconds(F f) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+  f();
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+  return chrono::duration_cast<chrono::duration<double>>(t2 - t1).count();
+}
+
+int main(int argc, char **argv) {
+  size_t max_d = argc > 1 ? atoi(argv[1]) : 5000;
+  vector<size_t> sizes = {100, 200, 500, 1000, 2000, 5000};
+
+  cout << "d, scalar_inverse, trtri_inverse, inverse_solve, trtrs_solve, "
+    << "copy_vec_solve, trans_vec_solve" << endl;
+  for (size_t d : sizes) {
+    if (d > max_d)
+      break;
+    mat A = randn<mat>(d, d);
+    mat R = chol(A.t() * A + d * eye<mat>(d, d));
+    mat B = randn<mat>(d, 10);
+    vec b = randn<vec>(d);
+    mat inv_a, inv_b, X_a, X_b;
+    vec x_a, x_b;
+    const size_t reps = 100;
+
+    double t_scalar = seconds([&] {
+      inv_a = scalar_upper_triangular_inverse(R);
+    });
+    double t_trtri = seconds([&] {
+      inv_b = gplib::triangular_inverse(R);
+    });
+    // R' * X = B, through the explicit inverse and through trtrs.
+    double t_inv_solve = seconds([&] {
+      X_a = scalar_upper_triangular_inverse(R).t() * B;
+    });
+    double t_trtrs = seconds([&] {
+      X_b = gplib::triangular_solve(R, B, true, true);
+    });
+    double t_copy_vec = seconds([&] {
+      for (size_t r = 0; r < reps; ++r) {
+        mat R_t = R.t();
+        x_a = solve(trimatl(R_t), b);
+      }
+    });
+    double t_trans_vec = seconds([&] {
+      for (size_t r = 0; r < reps; ++r)
+        x_b = gplib::triangular_solve(R, b, true, true);
+    });
+
+    if (norm(inv_a - inv_b, "inf") > 1e-8 * norm(inv_a, "inf") ||
+        norm(X_a - X_b, "inf") > 1e-8 * norm(X_a, "inf") ||
+        norm(x_a - x_b, "inf") > 1e-8 * norm(x_a, "inf")) {
+      cerr << "Mismatch for d = " << d << endl;
+      return 1;
+    }
+    cout << d << ", " << t_scalar << ", " << t_trtri << ", " << t_inv_solve
+      << ", " << t_trtrs << ", " << t_copy_vec << ", " << t_trans_vec << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "arena.hpp"
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace gplib {
+
+  namespace {
+
+    // The size class is stored just before the returned pointer, the header
+    // keeps the alignment of the block.
+    const size_t alignment = 64;
+    const size_t header = 64;
+
+    // Four size classes per power of two, the waste is at most 25%.
+    size_t class_size(size_t n_bytes) {
+      if (n_bytes <= alignment)
+        return alignment;
+      size_t bits = 0;
+      while ((size_t(1) << bits) < n_bytes)
+        ++bits;
+      size_t shift = bits - 3;
+      size_t q = (n_bytes + (size_t(1) << shift) - 1) >> shift;
+      return q << shift;
+    }
+
+    struct pool {
+      mutex m;
+      unordered_map<size_t, vector<void*>> free_blocks;
+      size_t reserved = 0;
+      size_t cached = 0;
+    };
+
+    // Never destroyed, matrices with static storage may be freed after the
+    // destructors of this translation unit ran.
+    pool &get_pool() {
+      static pool *instance = new pool();
+      return *instance;
+    }
+  };
+
+  void *arena_alloc(size_t n_bytes) {
+    size_t size = class_size(n_bytes);
+    pool &p = get_pool();
+    {
+      lock_guard<mutex> lock(p.m);
+      vector<void*> &blocks = p.free_blocks[size];
+      if (!blocks.empty()) {
+        void *ans = blocks.back();
+        blocks.pop_back();
+        p.cached -= size;
+        return ans;
+      }
+    }
+
+    void *raw = nullptr;
+    if (posix_memalign(&raw, alignment, size + header) != 0)
+      throw bad_alloc();
+    *static_cast<size_t*>(raw) = size;
+    {
+      lock_guard<mutex> lock(p.m);
+      p.reserved += size;
+    }
+    return static_cast<char*>(raw) + header;
+  }
+
+  void arena_free(void *ptr) {
+    if (ptr == nullptr)
+      return;
+    void *raw = static_cast<char*>(ptr) - header;
+    size_t size = *static_cast<size_t*>(raw);
+    pool &p = get_pool();
+    lock_guard<mutex> lock(p.m);
+    p.free_blocks[size].push_back(ptr);
+    p.cached += size;
+  }
+
+  void arena_release() {
+    pool &p = get_pool();
+    lock_guard<mutex> lock(p.m);
+    for (auto &blocks : p.free_blocks) {
+      for (void *ptr : blocks.second)
+        free(static_cast<char*>(ptr) - header);
+      p.reserved -= blocks.first * blocks.second.size();
+    }
+    p.free_blocks.clear();
+    p.cached = 0;
+  }
+
+  size_t arena_reserved_bytes() {
+    pool &p = get_pool();
+    lock_guard<mutex> lock(p.m);
+    return p.reserved;
+  }
+
+  size_t arena_cached_bytes() {
+    pool &p = get_pool();
+    lock_guard<mutex> lock(p.m);
+    return p.cached;
+  }
+};
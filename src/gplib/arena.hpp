@@ -0,0 +1,51 @@
+#ifndef GPLIB_ARENA
+#define GPLIB_ARENA
+
+/* This header must be included before <armadillo>, when GPLIB_USE_ARENA is
+ * defined it routes all the Armadillo heap allocations to the arena. The
+ * library and the programs using it must agree on the flag. */
+
+#include <cstddef>
+
+namespace gplib {
+
+  /**
+   *  Returns a block of at least n_bytes bytes aligned to 64 bytes. Blocks
+   *  are grouped in size classes and the ones returned with arena_free are
+   *  reused by the next request of the same class, so the buffers of an
+   *  iterative computation (e.g. the training objectives) stop hitting the
+   *  system allocator after the first iteration. Thread safe.
+   **/
+  void *arena_alloc(size_t n_bytes);
+
+  /**
+   *  Returns a block obtained from arena_alloc to the arena.
+   **/
+  void arena_free(void *ptr);
+
+  /**
+   *  Gives the cached blocks back to the system.
+   **/
+  void arena_release();
+
+  /**
+   *  Returns the number of bytes currently obtained from the system, both in
+   *  use and cached.
+   **/
+  size_t arena_reserved_bytes();
+
+  /**
+   *  Returns the number of bytes cached for reuse.
+   **/
+  size_t arena_cached_bytes();
+};
+
+#ifdef GPLIB_USE_ARENA
+  #ifdef ARMA_INCLUDES
+    #error "gplib/arena.hpp must be included before armadillo"
+  #endif
+  #define ARMA_ALIEN_MEM_ALLOC_FUNCTION gplib::arena_alloc
+  #define ARMA_ALIEN_MEM_FREE_FUNCTION gplib::arena_free
+#endif
+
+#endif
@@ -3,25 +3,96 @@
 using namespace arma;
 using namespace std;
 
+// LAPACK triangular solve, Armadillo only reaches it for op(T) = T, the
+// transposed systems would need a copy of the factor.
+extern "C" void dtrtrs_(const char *uplo, const char *trans, const char *diag,
+    const blas_int *n, const blas_int *nrhs, const double *A,
+    const blas_int *lda, double *B, const blas_int *ldb, blas_int *info);
+
 namespace gplib {
   mat upper_triangular_inverse(const mat &upper_t) {
-    size_t d = upper_t.n_rows;
-    mat ans(d, d);
-    ans.fill(0.0);
-    vector<double> tmp(d);
-    for (size_t i = 0; i < d; i++) {
-      ans(i, i) = 1.0 / upper_t(i, i);
-      for (size_t j = i + 1; j < d; j++)
-        tmp[j] = upper_t(i, j) / upper_t(i, i);
-      for (size_t j = i + 1; j < d; j++) {
-        double factor = ans(i, j) = -tmp[j] / upper_t(j, j);
-        for (size_t k = j + 1; k < d; k++)
-          tmp[k] += factor * upper_t(j, k);
-      }
+    return triangular_inverse(upper_t, true);
+  }
+
+  // Exact zeros on the diagonal, the case where trtri and trtrs fail.
+  static void check_singular(const mat &T) {
+    if (any(T.diag() == 0.0))
+      throw runtime_error("Singular triangular matrix");
+  }
+
+  mat triangular_inverse(const mat &T, bool upper) {
+    if (T.n_rows != T.n_cols)
+      throw logic_error("Triangular matrix must be square");
+    if (T.n_rows == 0)
+      return mat(0, 0);
+    check_singular(T);
+
+    mat ans;
+    bool ok = upper ? inv(ans, trimatu(T)) : inv(ans, trimatl(T));
+    if (!ok)
+      throw runtime_error("Singular triangular matrix");
+    return ans;
+  }
+
+  mat triangular_solve(const mat &T, const mat &B, bool upper, bool trans) {
+    if (T.n_rows != T.n_cols || T.n_rows != B.n_rows)
+      throw length_error("Wrong dimensions in triangular solve");
+    if (B.n_rows == 0 || B.n_cols == 0)
+      return B;
+    check_singular(T);
+
+    mat ans;
+    bool ok;
+    if (!trans) {
+      ok = upper ? solve(ans, trimatu(T), B) : solve(ans, trimatl(T), B);
+    } else {
+      // Reads T' from T in place, only the right hand side is copied
+      ans = B;
+      char uplo = upper ? 'U' : 'L', op = 'T', unit = 'N';
+      blas_int n = T.n_rows, nrhs = B.n_cols, info = 0;
+      dtrtrs_(&uplo, &op, &unit, &n, &nrhs, T.memptr(), &n, ans.memptr(), &n,
+          &info);
+      ok = info == 0;
     }
+    if (!ok)
+      throw runtime_error("Singular triangular matrix");
+    return ans;
+  }
+
+  vec triangular_solve(const mat &T, const vec &b, bool upper, bool trans) {
+    return triangular_solve(T, mat(b), upper, trans);
+  }
+
+  mat chol_solve(const mat &R, const mat &B) {
+    return triangular_solve(R, triangular_solve(R, B, true, true), true, false);
+  }
+
+  double chol_log_det(const mat &R) {
+    double ans = 0;
+    for (size_t i = 0; i < R.n_rows; ++i)
+      ans += 2.0 * log(R(i, i));
     return ans;
   }
 
+  double robust_chol(const mat &A, mat &R, size_t max_tries) {
+    if (A.n_rows != A.n_cols)
+      throw logic_error("Cholesky factorization of a non square matrix");
+    if (chol(R, A))
+      return 0.0;
+
+    double scale = mean(abs(A.diag()));
+    if (!std::isfinite(scale))
+      throw factorization_error("Non finite values in the matrix to factorize");
+    double jitter = 1e-10 * (scale > 0 ? scale : 1.0);
+    mat tmp = A;
+    for (size_t i = 0; i < max_tries; ++i, jitter *= 10.0) {
+      tmp.diag() = A.diag() + jitter;
+      if (chol(R, tmp))
+        return jitter;
+    }
+    throw factorization_error("Matrix is not positive definite");
+  }
+
   arma::vec get_observed_only(const arma::vec &vec,
                               const vector<bool> &observed) {
     vector<double> tmp;
@@ -85,9 +156,15 @@ namespace gplib {
   }
 
   mat flatten(vector<vec> &y) {
-    mat flat;
-    for (size_t i = 0; i < y.size(); i++) {
-      flat = join_cols<mat> (flat, y[i]);
+    size_t t_size = 0;
+    for (size_t i = 0; i < y.size(); ++i)
+      t_size += y[i].n_elem;
+
+    mat flat(t_size, 1);
+    size_t iter = 0;
+    for (size_t i = 0; i < y.size(); ++i) {
+      copy(y[i].begin(), y[i].end(), flat.begin() + iter);
+      iter += y[i].n_elem;
     }
     return flat;
   }
@@ -97,12 +174,13 @@ namespace gplib {
     for (size_t i = 0; i < M.size(); ++i)
       t_size += M[i].size();
 
+    // Row major, the order used by unflatten and by the input derivatives
     vector<double> ans(t_size);
     size_t iter = 0;
-    for (size_t q = 0; q < M.size(); ++q) {
-      copy (M[q].begin(), M[q].end(), ans.begin() + iter);
-      iter += M[q].size();
-    }
+    for (size_t q = 0; q < M.size(); ++q)
+      for (size_t i = 0; i < M[q].n_rows; ++i)
+        for (size_t j = 0; j < M[q].n_cols; ++j)
+          ans[iter++] = M[q](i, j);
     return ans;
   }
 
@@ -5,14 +5,80 @@
 
 #include <cmath>
 #include <map>
+#include <stdexcept>
 #include <vector>
 
 namespace gplib {
   //definition of basic constants
   const double pi = std::acos(-1);
+  //value returned by the training objectives when the covariance of the
+  //current parameters can not be factorized
+  const double failed_objective = -1e10;
 
+  /**
+   * Thrown when a matrix is not positive definite even after adding the
+   * largest jitter allowed to its diagonal.
+   * */
+  class factorization_error : public std::runtime_error {
+    public:
+      using std::runtime_error::runtime_error;
+  };
+
+  /**
+   * Returns the inverse of an upper triangular matrix.
+   * */
   arma::mat upper_triangular_inverse(const arma::mat &upper_t);
 
+  /**
+   * Returns the inverse of a triangular matrix, inv(trimatu(T)) or
+   * inv(trimatl(T)), which Armadillo computes with LAPACK trtri.
+   * @param T : Triangular matrix, the other triangle is ignored.
+   * @param upper : True if T is upper triangular, false if it is lower.
+   * */
+  arma::mat triangular_inverse(const arma::mat &T, bool upper = true);
+
+  /**
+   * Returns the solution x of op(T) * x = b, where op(T) is T or T' and T is
+   * triangular (solve on trimatu or trimatl, LAPACK trtrs). The transposed
+   * solve reads T in place, without copying it.
+   * @param T : Triangular matrix, the other triangle is ignored.
+   * @param b : Right hand side.
+   * @param upper : True if T is upper triangular, false if it is lower.
+   * @param trans : True to solve with T' instead of T.
+   * */
+  arma::vec triangular_solve(const arma::mat &T, const arma::vec &b,
+                             bool upper = true, bool trans = false);
+
+  /**
+   * Returns the solution X of op(T) * X = B for all the columns of B at once.
+   * Throws runtime_error when T has a zero on its diagonal.
+   * */
+  arma::mat triangular_solve(const arma::mat &T, const arma::mat &B,
+                             bool upper = true, bool trans = false);
+
+  /**
+   * Returns the solution X of R' * R * X = B, where R is the upper
+   * cholesky factor returned by arma::chol.
+   * */
+  arma::mat chol_solve(const arma::mat &R, const arma::mat &B);
+
+  /**
+   * Returns log(det(R' * R)) for an upper cholesky factor R.
+   * */
+  double chol_log_det(const arma::mat &R);
+
+  /**
+   * Computes the upper cholesky factor R of A + jitter * I. The jitter is 0
+   * when A is positive definite, otherwise it starts at 1e-10 times the mean
+   * of the diagonal of A and grows ten times per retry.
+   * @param A : Symmetric matrix.
+   * @param R : Output, upper cholesky factor.
+   * @param max_tries : Number of jittered retries before throwing
+   *                    factorization_error.
+   * @return The jitter added to the diagonal.
+   * */
+  double robust_chol(const arma::mat &A, arma::mat &R, size_t max_tries = 10);
+
   /**
    * Takes a vector of real values and a boolean vector telling which
    * dimensions are observed and returns a new vector with the
@@ -0,0 +1,146 @@
+#include "gplib.hpp"
+
+using namespace arma;
+using namespace std;
+
+namespace gplib {
+
+  mo_dataset::mo_dataset() : offsets(1, 0), dim(0) {}
+
+  mo_dataset::mo_dataset(const vector<mat> &X, const vector<vec> &y)
+    : mo_dataset() {
+    set(X, y);
+  }
+
+  mo_dataset::mo_dataset(const mo_dataset &other)
+    : x_buffer(other.x_buffer), y_buffer(other.y_buffer),
+      offsets(other.offsets), dim(other.dim) {
+    make_views();
+  }
+
+  mo_dataset &mo_dataset::operator=(const mo_dataset &other) {
+    if (&other != this) {
+      x_buffer = other.x_buffer;
+      y_buffer = other.y_buffer;
+      offsets = other.offsets;
+      dim = other.dim;
+      make_views();
+    }
+    return *this;
+  }
+
+  void mo_dataset::set(const vector<mat> &X, const vector<vec> &y) {
+    if (X.size() != y.size())
+      throw length_error("Inputs and outputs have different number of classes");
+
+    offsets.assign(1, 0);
+    dim = 0;
+    for (size_t i = 0; i < X.size(); ++i) {
+      if (X[i].n_rows != y[i].n_elem)
+        throw length_error("Inputs and outputs have different number of rows");
+      if (X[i].n_rows > 0) {
+        if (dim != 0 && X[i].n_cols != dim)
+          throw logic_error("Inputs dimension mismatched");
+        dim = X[i].n_cols;
+      }
+      offsets.push_back(offsets.back() + X[i].n_rows);
+    }
+
+    x_buffer.set_size(offsets.back() * dim);
+    y_buffer.set_size(offsets.back());
+    for (size_t i = 0; i < X.size(); ++i) {
+      copy(X[i].begin(), X[i].end(), x_buffer.begin() + offsets[i] * dim);
+      copy(y[i].begin(), y[i].end(), y_buffer.begin() + offsets[i]);
+    }
+    make_views();
+  }
+
+  void mo_dataset::append(const vector<mat> &X, const vector<vec> &y) {
+    if (n_rows() == 0) {
+      set(X, y);
+      return;
+    }
+    if (X.size() != n_outputs() || y.size() != n_outputs())
+      throw length_error("Wrong number of output classes");
+
+    vector<size_t> new_offsets(1, 0);
+    for (size_t i = 0; i < X.size(); ++i) {
+      if (X[i].n_rows != y[i].n_elem)
+        throw length_error("Inputs and outputs have different number of rows");
+      if (X[i].n_rows > 0 && X[i].n_cols != dim)
+        throw logic_error("Inputs dimension mismatched");
+      new_offsets.push_back(new_offsets.back() + n_rows(i) + X[i].n_rows);
+    }
+
+    // Every class moves, so both buffers are rebuilt class by class
+    vec new_x(new_offsets.back() * dim), new_y(new_offsets.back());
+    for (size_t i = 0; i < X.size(); ++i) {
+      size_t old_rows = n_rows(i);
+      mat block(new_x.memptr() + new_offsets[i] * dim,
+          old_rows + X[i].n_rows, dim, false, true);
+      if (old_rows > 0)
+        block.rows(0, old_rows - 1) = x_views[i];
+      if (X[i].n_rows > 0)
+        block.rows(old_rows, block.n_rows - 1) = X[i];
+      copy(y_views[i].begin(), y_views[i].end(),
+          new_y.begin() + new_offsets[i]);
+      copy(y[i].begin(), y[i].end(), new_y.begin() + new_offsets[i] + old_rows);
+    }
+    x_buffer.swap(new_x);
+    y_buffer.swap(new_y);
+    offsets = new_offsets;
+    make_views();
+  }
+
+  void mo_dataset::make_views() {
+    size_t n = offsets.size() - 1;
+    // Reserve first, a reallocation would copy the views.
+    x_views.clear();
+    y_views.clear();
+    x_views.reserve(n);
+    y_views.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      size_t rows = offsets[i + 1] - offsets[i];
+      if (rows == 0) {
+        x_views.push_back(mat(0, dim));
+        y_views.push_back(vec());
+        continue;
+      }
+      x_views.emplace_back(x_buffer.memptr() + offsets[i] * dim, rows, dim,
+          false, true);
+      y_views.emplace_back(y_buffer.memptr() + offsets[i], rows, false, true);
+    }
+  }
+
+  size_t mo_dataset::n_outputs() const {
+    return offsets.size() - 1;
+  }
+
+  size_t mo_dataset::n_rows() const {
+    return offsets.back();
+  }
+
+  size_t mo_dataset::n_rows(size_t i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+
+  size_t mo_dataset::n_cols() const {
+    return dim;
+  }
+
+  size_t mo_dataset::offset(size_t i) const {
+    return offsets[i];
+  }
+
+  const vector<mat> &mo_dataset::X() const {
+    return x_views;
+  }
+
+  const vector<vec> &mo_dataset::y() const {
+    return y_views;
+  }
+
+  const vec &mo_dataset::flat_y() const {
+    return y_buffer;
+  }
+};
@@ -0,0 +1,104 @@
+#ifndef GPLIB_DATASET
+#define GPLIB_DATASET
+
+#include "arena.hpp"
+
+#include <armadillo>
+#include <vector>
+
+namespace gplib {
+
+  class mo_dataset {
+    /**
+     *  Multioutput training set stored in two contiguous buffers, one for
+     *  the inputs and one for the outputs. The inputs of each output class
+     *  are a column major block of the input buffer and the outputs are
+     *  stored one class after the other, so the per class matrices and the
+     *  flattened output vector are views without copies.
+     **/
+    private:
+      arma::vec x_buffer;
+      arma::vec y_buffer;
+      std::vector<size_t> offsets; // First row of each output class
+      size_t dim;
+      std::vector<arma::mat> x_views;
+      std::vector<arma::vec> y_views;
+
+      void make_views();
+    public:
+      /**
+       *  Constructor
+       **/
+      mo_dataset();
+      /**
+       *  Constructor, copies the data into the contiguous buffers.
+       *  @param X : Vector of matrices, each matrix contains the inputs related
+       *             to each output class.
+       *  @param y : Vector of vectors, each vector contains the outputs related
+       *             to each output class.
+       **/
+      mo_dataset(const std::vector<arma::mat> &X,
+          const std::vector<arma::vec> &y);
+      /**
+       *  Copy constructor, the views of the copy point to its own buffers.
+       **/
+      mo_dataset(const mo_dataset &other);
+      /**
+       *  Assignment operator, the views point to the buffers of this object.
+       **/
+      mo_dataset &operator=(const mo_dataset &other);
+
+      /**
+       *  Replaces the data, see the constructor.
+       **/
+      void set(const std::vector<arma::mat> &X,
+          const std::vector<arma::vec> &y);
+      /**
+       *  Adds rows at the end of each output class, the rows of class i go
+       *  after the current rows of that class. An empty dataset is set.
+       *  @param X : New inputs of each output class (may have no rows).
+       *  @param y : New outputs of each output class.
+       **/
+      void append(const std::vector<arma::mat> &X,
+          const std::vector<arma::vec> &y);
+
+      /**
+       *  Returns the number of output classes.
+       **/
+      size_t n_outputs() const;
+      /**
+       *  Returns the total number of rows (inputs of all the output classes).
+       **/
+      size_t n_rows() const;
+      /**
+       *  Returns the number of rows of the output class i.
+       **/
+      size_t n_rows(size_t i) const;
+      /**
+       *  Returns the dimension of the inputs.
+       **/
+      size_t n_cols() const;
+      /**
+       *  Returns the position of the first value of the output class i in the
+       *  flattened output vector.
+       **/
+      size_t offset(size_t i) const;
+      /**
+       *  Returns the inputs of each output class, each matrix is a view of the
+       *  input buffer.
+       **/
+      const std::vector<arma::mat> &X() const;
+      /**
+       *  Returns the outputs of each output class, each vector is a view of
+       *  the output buffer.
+       **/
+      const std::vector<arma::vec> &y() const;
+      /**
+       *  Returns all the outputs concatenated, in the order of the output
+       *  classes.
+       **/
+      const arma::vec &flat_y() const;
+  };
+};
+
+#endif
@@ -2,12 +2,17 @@
 #ifndef GPLIB_GP
 #define GPLIB_GP
 
+#include "arena.hpp"
+
 #include <armadillo>
 #include <vector>
 #include <memory>
 #include <cassert>
 
 #include "mvgauss.hpp"
+#include "dataset.hpp"
+#include "multistart.hpp"
+#include "training.hpp"
 
 namespace gplib {
 
@@ -49,6 +54,62 @@ namespace gplib {
        **/
       virtual arma::mat derivate(size_t param_id, const arma::mat &X,
           const arma::mat &Y, bool diag = false) const = 0;
+      /**
+       *  Returns sum_ij W(i, j) * dK(i, j) / dT_d for each parameter d < n_params(),
+       *  which is what the training objectives need from the derivatives. The
+       *  default implementation contracts the output of derivate, kernels can
+       *  override it to do a single pass without derivative matrices.
+       *  @param W : Weights, with X.n_rows rows and Y.n_rows columns. If diag
+       *             is true only the diagonal is used, so W is a vector with
+       *             the X.n_rows diagonal weights.
+       *  @param X : First matrix for derivative evaluation.
+       *  @param Y : Second matrix for derivative evaluation.
+       *  @param diag : Same meaning as in derivate.
+       *  @param n_threads : Maximum number of threads, 0 means
+       *                     default_threads(). The result does not depend on
+       *                     it, partial sums are always reduced in the same
+       *                     order.
+       **/
+      virtual std::vector<double> contract(const arma::mat &W,
+          const arma::mat &X, const arma::mat &Y, bool diag = false,
+          size_t n_threads = 0) const;
+      /**
+       *  Returns the derivatives of eval(X, Z) wrt every coordinate of Z in
+       *  compact form, ans(i, m, c) = dK(X_i, Z_m) / dZ(m, c). Only column m
+       *  of eval(X, Z) depends on row m of Z, so this keeps all the non zero
+       *  entries of the Z.n_rows * Z.n_cols matrices returned by derivate for
+       *  the input ids (derivate(n_params() + m * Z.n_cols + c, X, Z)). The
+       *  default implementation extracts them from derivate, so Z must not
+       *  have more elements than X.
+       *  @param X : First matrix for derivative evaluation.
+       *  @param Z : Inputs to derivate with respect to (e.g. pseudo-inputs).
+       **/
+      virtual arma::cube derivate_wrt_inputs(const arma::mat &X,
+          const arma::mat &Z) const;
+      /**
+       *  Returns true if the kernel only depends on the squared distances
+       *  d2(i, j) = |X.row(i) - Y.row(j)|^2, so it can be evaluated with the
+       *  *_distances methods from distances computed once and shared by
+       *  several kernels. The default is false.
+       **/
+      virtual bool isotropic() const;
+      /**
+       *  Same as eval(X, Y) from the squared distances of X and Y, only for
+       *  isotropic kernels (the default throws logic_error).
+       *  @param d2 : X.n_rows x Y.n_rows matrix of squared distances.
+       **/
+      virtual arma::mat eval_distances(const arma::mat &d2) const;
+      /**
+       *  Same as derivate(param_id, X, Y) from the squared distances, only
+       *  for the parameters in n_params().
+       **/
+      virtual arma::mat derivate_distances(size_t param_id,
+          const arma::mat &d2) const;
+      /**
+       *  Same as contract(W, X, Y) from the squared distances.
+       **/
+      virtual std::vector<double> contract_distances(const arma::mat &W,
+          const arma::mat &d2, size_t n_threads = 0) const;
       /**
        *  Returns the number of params needed by the kernel.
        **/
@@ -84,6 +145,37 @@ namespace gplib {
        *  of the parameters of the kernel.
        **/
       virtual std::vector<double> get_upper_bounds() const = 0;
+      /**
+       *  Returns a copy of the kernel that does not share its parameters or
+       *  bounds with this one, e.g. to train copies of a model concurrently.
+       *  Only needed by the multi-start training, the default throws
+       *  logic_error.
+       **/
+      virtual std::shared_ptr<kernel_class> clone() const;
+    };
+
+    class posterior_path {
+    /**
+     *  Posterior function sample drawn by pathwise conditioning (Matheron's
+     *  rule), a random Fourier feature prior draw plus a data dependent
+     *  update. It can be evaluated at any set of points.
+     *  @ref : https://arxiv.org/abs/2002.09309
+     **/
+    private:
+      struct implementation;
+      std::shared_ptr<implementation> pimpl;
+      friend class gp_reg;
+    public:
+      /**
+       * Constructor
+       **/
+      posterior_path();
+      /**
+       *  Evaluates the sampled function, the cost is linear in the number of
+       *  training points and features for each point.
+       *  @param X : Matrix of inputs, each row represents one input.
+       **/
+      arma::vec eval(const arma::mat &X) const;
     };
 
     class gp_reg {
@@ -118,17 +210,82 @@ namespace gplib {
        *  @param y : Vector of known outputs corresponding to the known inputs.
        **/
       void set_training_set(const arma::mat &X, const arma::vec &y);
+      /**
+       *  Appends observations to the training set. If the cached factor of
+       *  the training covariance is valid for the current kernel parameters
+       *  it is extended with a block update, O(N^2 * k) for k new rows
+       *  instead of O((N + k)^3). With a window set, the oldest rows beyond
+       *  it are removed afterwards.
+       *  @param X : New inputs, one per row.
+       *  @param y : New outputs.
+       **/
+      void add_observations(const arma::mat &X, const arma::vec &y);
+      /**
+       *  Removes the n_rows oldest (first) observations, the cached factor is
+       *  downdated with rank one updates in O(N^2 * n_rows).
+       **/
+      void remove_oldest(size_t n_rows);
+      /**
+       *  Keeps at most n_rows observations, add_observations drops the oldest
+       *  ones to stay within it, so a streaming predictor has a constant cost
+       *  per update.
+       *  @param n_rows : Size of the window, 0 keeps all the observations.
+       **/
+      void set_window(size_t n_rows);
+      /**
+       *  Sets the number of threads used by the gradient of the training
+       *  objective in the following calls to train. The trained parameters
+       *  do not depend on it.
+       *  @param n_threads : Maximum number of threads, 0 means
+       *                     default_threads().
+       **/
+      void set_threads(size_t n_threads);
+      /**
+       *  Sets the optimizer, parameter transforms and budgets used by the
+       *  following calls to train. The max_iter and tol arguments of those
+       *  calls replace max_eval and xtol_rel.
+       **/
+      void set_train_options(const train_options &options);
+      /**
+       *  Returns the options used by train.
+       **/
+      const train_options &get_train_options() const;
+      /**
+       *  Stores the options and trains the model with them.
+       *  @param options : Optimizer, parameter transforms and budgets.
+       **/
+      double train(const train_options &options);
       /**
        *  Trains the model using the provided training set
        *  @param max_iter : Maximum number of iterations.
        *  @param tol : Relative tolerance on the optimization parameters.
        **/
       double train(int max_iter, double tol);
+      /**
+       *  Trains the model from n_starts points spread inside the kernel
+       *  bounds and keeps the best result. The starts run concurrently, each
+       *  one on its own copy of the model, so the wall time is close to the
+       *  one of a single start when there are enough cores. The kernel must
+       *  implement clone, otherwise logic_error is thrown before training.
+       *  @param max_iter : Maximum number of iterations of each start.
+       *  @param tol : Relative tolerance on the optimization parameters.
+       *  @param n_starts : Number of starting points.
+       *  @param rng : Stream used to draw the starting points.
+       *  @param design : LATIN_HYPERCUBE or SOBOL.
+       *  @param drop_margin : If finite, after a quarter of the iterations the
+       *                       starts whose log marginal likelihood is more than
+       *                       this below the best one are stopped.
+       *  @return The log marginal likelihood of the best start.
+       **/
+      double train(int max_iter, double tol, size_t n_starts, rng_stream &rng,
+          int design = LATIN_HYPERCUBE, double drop_margin = HUGE_VAL);
       /**
        *  Uses the already trained model to predict output values for new
        *  inputs provided in the parameter, this method returns the complete
        *  multivariate gaussian distribution resulting from the regression
-       *  process.
+       *  process. The factor of the training covariance is cached by the
+       *  first call, the const methods can be called concurrently and
+       *  share it, one at a time.
        *  @param new_data : A matrix containing points for which output data
        *                    is unknown.
        **/
@@ -142,6 +299,43 @@ namespace gplib {
        *                    is unknown.
        **/
       arma::vec predict(const arma::mat &new_data) const;
+      /**
+       *  Draws a function from the posterior using pathwise conditioning,
+       *  only the factorization of the training covariance is needed, so the
+       *  sample can be evaluated on large candidate sets (e.g. for Thompson
+       *  sampling). Requires a squared exponential kernel.
+       *  @param n_features : Number of random Fourier features of the prior
+       *                      draw.
+       *  @param rng : Stream used to draw the sample.
+       **/
+      posterior_path sample_path(size_t n_features, rng_stream &rng) const;
+    };
+
+    struct block_derivative {
+      /**
+       *  Derivative of a multioutput covariance stored as its non-zero
+       *  blocks. Block k covers the rows first_row[k] to
+       *  first_row[k] + blocks[k].n_rows - 1 and the columns first_col[k] to
+       *  first_col[k] + blocks[k].n_cols - 1 of the n_rows x n_cols matrix,
+       *  everything else is zero.
+       **/
+      size_t n_rows = 0, n_cols = 0;
+      std::vector<size_t> first_row, first_col;
+      std::vector<arma::mat> blocks;
+
+      /**
+       *  Adds a block with its top left corner at (row, col).
+       **/
+      void add(size_t row, size_t col, const arma::mat &block);
+      /**
+       *  Returns the full matrix.
+       **/
+      arma::mat dense() const;
+      /**
+       *  Returns accu(W % dense()) without forming it, or with diag
+       *  dot(W, dense().diag()) for a vector W of diagonal weights.
+       **/
+      double contract(const arma::mat &W, bool diag = false) const;
     };
 
     class multioutput_kernel_class {
@@ -175,9 +369,12 @@ namespace gplib {
        *                for the entries pertaining to the diagonal of the answer
        *                matrix, this is due to performance reasons while using
        *                FITC.
+       *  @param n_threads : Maximum number of threads, 0 means
+       *                     default_threads(). The result does not depend on it.
        **/
       virtual arma::mat eval(const std::vector<arma::mat> &X,
-        const std::vector<arma::mat> &Y, bool diag = false) const = 0;
+        const std::vector<arma::mat> &Y, bool diag = false,
+        size_t n_threads = 0) const = 0;
       /**
        *  Returns the value of the derivative wrt a certain parameter with a
        *  a particular pair of input matrices.
@@ -192,6 +389,39 @@ namespace gplib {
        **/
       virtual arma::mat derivate(size_t param_id, const std::vector<arma::mat> &X,
           const std::vector<arma::mat> &Y, bool diag = false) const = 0;
+      /**
+       *  Same derivative as derivate, as its non-zero blocks. The default
+       *  implementation returns the output of derivate as a single block.
+       **/
+      virtual block_derivative derivate_blocks(size_t param_id,
+          const std::vector<arma::mat> &X, const std::vector<arma::mat> &Y,
+          bool diag = false) const;
+      /**
+       *  Returns sum_ij W(i, j) * dK(i, j) / dT_d for each parameter d < n_params()
+       *  (parameter matrices and inner kernels, not the inputs). The default
+       *  implementation contracts the blocks of derivate_blocks.
+       *  @param W : Weights, same shape as eval(X, Y). If diag is true it is a
+       *             vector with the diagonal weights.
+       *  @param X : First vector of matrices for derivative evaluation.
+       *  @param Y : Second vector of matrices for derivative evaluation.
+       *  @param diag : Same meaning as in derivate.
+       *  @param n_threads : Maximum number of threads, 0 means
+       *                     default_threads(). The result does not depend on it.
+       **/
+      virtual std::vector<double> contract(const arma::mat &W,
+          const std::vector<arma::mat> &X, const std::vector<arma::mat> &Y,
+          bool diag = false, size_t n_threads = 0) const;
+      /**
+       *  Returns the derivatives of eval(X, Z) wrt every coordinate of the
+       *  matrices in Z in compact form, ans(i, m, c) = dK(i, m) / dZ_m(c),
+       *  where m runs over the rows of all the matrices in Z, in order. The
+       *  default implementation extracts them from derivate, so the matrices
+       *  of Z must not have more elements than those of X.
+       *  @param X : First vector of matrices for derivative evaluation.
+       *  @param Z : Inputs to derivate with respect to (e.g. pseudo-inputs).
+       **/
+      virtual arma::cube derivate_wrt_inputs(const std::vector<arma::mat> &X,
+          const std::vector<arma::mat> &Z) const;
       /**
        *  Returns the total number of parameters needed bythe kernel (parameter
        *  matrices, plus the parameters of each inner kernel).
@@ -275,6 +505,12 @@ namespace gplib {
        * those of the inner kernels.
        **/
       virtual std::vector<double> get_upper_bounds() const = 0;
+      /**
+       *  Returns a copy of the kernel, including copies of the inner kernels,
+       *  that does not share any parameter with this one. Only needed by the
+       *  multi-start training, the default throws logic_error.
+       **/
+      virtual std::shared_ptr<multioutput_kernel_class> clone() const;
     };
 
     class gp_reg_multi {
@@ -313,6 +549,45 @@ namespace gplib {
        **/
       void set_training_set(const std::vector<arma::mat> &X,
         const std::vector<arma::vec> &y);
+      /**
+       *  Sets the training set from an already built multioutput dataset.
+       *  @param data : Inputs and outputs of each output class.
+       **/
+      void set_training_set(const mo_dataset &data);
+      /**
+       *  Sets the number of threads used by the covariance evaluations and
+       *  the gradients of the training objectives (full and FITC) in the
+       *  following calls to train. The trained parameters do not depend on
+       *  it.
+       *  @param n_threads : Maximum number of threads, 0 means
+       *                     default_threads().
+       **/
+      void set_threads(size_t n_threads);
+      /**
+       *  Sets the objective of the trainings with inducing points, FITC (the
+       *  default) or VFE (the variational bound of Titsias, which does not
+       *  overfit the noise and moves the pseudo-inputs less). Both cost
+       *  O(N * M^2) and the predictor follows the chosen approximation.
+       *  @param mode : FITC or VFE.
+       *  @ref : http://proceedings.mlr.press/v5/titsias09a/titsias09a.pdf
+       **/
+      void set_sparse_mode(int mode);
+      /**
+       *  Sets the optimizer, parameter transforms and budgets used by the
+       *  following calls to train (full and FITC). The max_iter and tol
+       *  arguments of those calls replace max_eval and xtol_rel.
+       **/
+      void set_train_options(const train_options &options);
+      /**
+       *  Returns the options used by train.
+       **/
+      const train_options &get_train_options() const;
+      /**
+       *  Stores the options and trains the model using the standard
+       *  procedure with them.
+       *  @param options : Optimizer, parameter transforms and budgets.
+       **/
+      double train(const train_options &options);
       /**
        *  Trains the model using the standard procedure, in accordance to the
        *  provided training set.
@@ -326,7 +601,9 @@ namespace gplib {
        *  @param num_pi : Number of inducing points per output class, should be
        *                  smaller than the smallest number of inputs for any
        *                  output class, use of this parameter triggers the use
-       *                  of FITC instead of the full regression.
+       *                  of FITC instead of the full regression. The points
+       *                  are placed as the inducing_init of the train
+       *                  options says.
        **/
       double train(const int max_iter, const double tol, const size_t num_pi,
         bool opt_pi = false);
@@ -348,6 +625,62 @@ namespace gplib {
        * */
       double train(const int max_iter, const double tol,
         const std::vector<arma::mat> num_pi, bool opt_pi = false);
+      /**
+       *  Trains the model from n_starts points spread inside the kernel
+       *  bounds and keeps the best result, the starts run concurrently on
+       *  copies of the model. It uses the current mode, after a FITC training
+       *  the starts keep the current pseudo-inputs and sigma as their
+       *  initial values. The kernel must implement clone, otherwise
+       *  logic_error is thrown before training.
+       *  @param n_starts : Number of starting points.
+       *  @param rng : Stream used to draw the starting points.
+       *  @param design : LATIN_HYPERCUBE or SOBOL.
+       *  @param drop_margin : If finite, after a quarter of the iterations the
+       *                       starts whose objective is more than this below
+       *                       the best one are stopped.
+       *  @param opt_pi : Also optimize the pseudo-inputs (FITC only).
+       **/
+      double train(const int max_iter, const double tol, const size_t n_starts,
+        rng_stream &rng, int design = LATIN_HYPERCUBE,
+        double drop_margin = HUGE_VAL, bool opt_pi = false);
+      /**
+       *  Adds new observations and continues the training from the current
+       *  state instead of starting over. The kernel parameters, sigma, the
+       *  pseudo-inputs (FITC) and the training options are kept, and in FITC
+       *  the cached factor of Kuu is reused so only the new rows are
+       *  evaluated at the current parameters. A few iterations are usually
+       *  enough when the new rows are a small fraction of the data.
+       *  @param new_X : New inputs of each output class (may have no rows).
+       *  @param new_y : New outputs of each output class.
+       *  @param max_iter : Maximum number of iterations.
+       *  @param tol : Relative tolerance on the optimization parameters.
+       *  @param opt_pi : Also optimize the pseudo-inputs (FITC only).
+       **/
+      double retrain(const std::vector<arma::mat> &new_X,
+        const std::vector<arma::vec> &new_y, const int max_iter = 10,
+        const double tol = 1e-4, bool opt_pi = false);
+      /**
+       *  Adds a batch of observations to the FITC predictor without
+       *  retraining, in O(B * M^2) for B new rows. The predictor keeps
+       *  A = Kuf * inv(lambda) * Kfu and b = Kuf * inv(lambda) * y, which are
+       *  sums over the rows, so the old rows are not touched.
+       *  @ref : https://arxiv.org/abs/1705.07131
+       *  @param new_X : New inputs of each output class (may have no rows).
+       *  @param new_y : New outputs of each output class.
+       *  @param keep_rows : Also append the rows to the training set, so a
+       *                     later retrain uses them. Otherwise they only
+       *                     live in the predictor and are lost when the
+       *                     parameters or the training set change.
+       **/
+      void stream_update(const std::vector<arma::mat> &new_X,
+        const std::vector<arma::vec> &new_y, bool keep_rows = false);
+      /**
+       *  Moves the FITC predictor to new inducing points, keeping the
+       *  current posterior at them, in O(M^3). Useful when the data drifts
+       *  away from the old inducing points during streaming.
+       *  @param new_M : New inducing points of each output class.
+       **/
+      void refresh_inducing_points(const std::vector<arma::mat> &new_M);
       /**
        *  Uses the already trained model to predict output values for new
        *  inputs provided in the parameter,this method returns the complete
@@ -363,11 +696,25 @@ namespace gplib {
        *  inputs provided in the parameter, this method returns only the mean
        *  of the multivariate gaussian distribution resulting from the
        *  regression process, which is the "best guess" for each new input.
+       *  The statistics of the predictor are cached by the first call, the
+       *  predictions can be called concurrently and run one at a time.
        *  @param new_data : A vector of matrices containing points for which
        *                    output data is unknown in one or more of the output
        *                    classes.
        **/
       arma::vec predict(const std::vector<arma::mat> &new_data) const;
+      /**
+       *  Returns the training objective at the current parameters, the log
+       *  marginal likelihood of the full model, or the FITC one or the VFE
+       *  bound after a sparse training.
+       **/
+      double objective();
+      /**
+       *  Same as objective() and puts its gradient in grad, wrt the kernel
+       *  parameters in the full model and wrt get_all_params() (kernel
+       *  parameters, pseudo-inputs and sigma) in the sparse ones.
+       **/
+      double objective(std::vector<double> &grad);
       /**
        *  Returns a vector with the complete set of parameters required by the
        *  multioutput regression (except pseudo-inputs using FITC, multioutput
@@ -390,7 +737,7 @@ namespace gplib {
        **/
 
       void set_params(const std::vector<double> &params);
-      enum {FULL, FITC};
+      enum {FULL, FITC, VFE};
     };
 };
 
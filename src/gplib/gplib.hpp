@@ -13,8 +13,15 @@
 #define GPLIB_VERSION \
     GPLIB_MAKE_VERSION(GPLIB_VERSION_MAJOR, GPLIB_VERSION_MINOR, GPLIB_VERSION_PATCH)
 
+#include "arena.hpp"
+#include "parallel.hpp"
+#include "random.hpp"
+#include "multistart.hpp"
+#include "inducing.hpp"
+#include "training.hpp"
 #include "mvgauss.hpp"
 #include "basic.hpp"
+#include "dataset.hpp"
 #include "gp.hpp"
 #include "kernels.hpp"
 #include "multioutput_kernels.hpp"
@@ -1,32 +1,210 @@
 #include "gplib.hpp"
-#include <nlopt.hpp>
 
 using namespace arma;
 using namespace std;
 
 namespace gplib {
 
+  struct posterior_path::implementation {
+    mat X;     // Training inputs
+    vec v;     // inv(K) * (y - prior(X) - noise)
+    mat W;     // Random frequencies, one per row
+    rowvec b;  // Random phases
+    vec w;     // Feature weights, already scaled
+    double sigma, length;
+
+    vec eval(const mat &Z) {
+      return prior(Z) + cross_cov(Z) * v;
+    }
+
+    vec prior(const mat &Z) {
+      mat phi = Z * W.t();
+      phi.each_row() += b;
+      return cos(phi) * w;
+    }
+
+    // Noise free squared exponential between Z and the training inputs
+    mat cross_cov(const mat &Z) {
+      mat d2 = -2.0 * Z * X.t();
+      d2.each_col() += sum(square(Z), 1);
+      d2.each_row() += sum(square(X), 1).t();
+      d2.elem(find(d2 < 0)).zeros();
+      return sigma * sigma * exp(d2 / (-2.0 * length * length));
+    }
+  };
+
+  posterior_path::posterior_path() {
+    pimpl = make_shared<implementation>();
+  }
+
+  vec posterior_path::eval(const mat &X) const {
+    return pimpl-> eval(X);
+  }
+
   struct gp_reg::implementation {
     shared_ptr<kernel_class> kernel;
     mat X; //Matrix of inputs
     vec y; //vector of outputs
     // double noise;
+    mat K_chol; // chol(K(X, X)), valid for the kernel params in factor_params
+    vector<double> factor_params;
+    // Held by the const methods, which fill K_chol on demand
+    cache_mutex factor_lock;
+    size_t n_threads = 0; // Threads of the objective gradient
+    size_t window = 0; // Maximum number of rows kept, 0 keeps all of them
+    train_options options;
+
+    // Buffers of the training objective, kept between the nlopt iterations.
+    // Expressions (products, sums) are written into their memory, matrices
+    // returned by functions (eval, force_symmetric, chol_solve) replace it
+    // and only recycle the old blocks with the ARENA=1 build.
+    struct workspace {
+      mat K, R, Kinv, dLLdK;
+      vec alpha;
+    } ws;
+
+    void update_factor() {
+      vector<double> params = kernel-> get_params();
+      if (K_chol.n_rows == X.n_rows && params == factor_params)
+        return;
+      robust_chol(force_symmetric(kernel-> eval(X, X)), K_chol);
+      factor_params = params;
+    }
+
+    void clear_factor() {
+      K_chol.reset();
+      factor_params.clear();
+    }
+
+    // Covariance between two different sets of points. eval(A, B) adds the
+    // noise term to the entries (i, i) even when A and B are different
+    // sets, so B is stacked on top of A and those rows are dropped.
+    mat cross_cov(const mat &A, const mat &B) {
+      if (A.n_rows == 0)
+        return mat(0, B.n_rows);
+      return kernel-> eval(join_vert(B, A), B).rows(B.n_rows,
+          B.n_rows + A.n_rows - 1);
+    }
+
+    bool factor_valid() {
+      return K_chol.n_rows == X.n_rows && kernel &&
+        kernel-> get_params() == factor_params;
+    }
+
+    // With K = R' * R, the factor of [K B; B' C] is [R S; 0 R2] where
+    // S = R' \ B and R2' * R2 = C - S' * S, O(N^2 * k) for k new rows.
+    void add_observations(const mat &new_X, const vec &new_y) {
+      if (new_X.n_rows != new_y.n_elem)
+        throw length_error("Inputs and outputs have different number of rows");
+      if (X.n_rows > 0 && new_X.n_cols != X.n_cols)
+        throw logic_error("Inputs dimension mismatched");
+      if (new_X.n_rows == 0)
+        return;
+
+      bool extend = X.n_rows > 0 && factor_valid();
+      if (extend) {
+        mat B = cross_cov(X, new_X);
+        mat C = force_symmetric(kernel-> eval(new_X, new_X));
+        mat S = triangular_solve(K_chol, B, true, true);
+        mat R2;
+        robust_chol(force_symmetric(C - S.t() * S), R2);
+
+        size_t n = K_chol.n_rows, k = new_X.n_rows;
+        mat R = zeros<mat>(n + k, n + k);
+        R.submat(0, 0, n - 1, n - 1) = K_chol;
+        R.submat(0, n, n - 1, n + k - 1) = S;
+        R.submat(n, n, n + k - 1, n + k - 1) = R2;
+        K_chol.swap(R);
+      }
+      X = join_vert(X, new_X);
+      y = join_vert(y, new_y);
+      if (!extend)
+        clear_factor();
+
+      if (window > 0 && X.n_rows > window)
+        remove_oldest(X.n_rows - window);
+    }
+
+    // Removing the first k rows leaves K22 = R12' * R12 + R22' * R22, so the
+    // new factor is R22 after k rank one updates with the rows of R12,
+    // O(N^2 * k) with Givens rotations.
+    void remove_oldest(size_t k) {
+      if (k > X.n_rows)
+        throw length_error("Removing more rows than available");
+      if (k == 0)
+        return;
+      if (k == X.n_rows) {
+        X.reset();
+        y.reset();
+        clear_factor();
+        return;
+      }
+
+      if (factor_valid()) {
+        size_t n = K_chol.n_rows;
+        // Work on L = R' so the updates sweep contiguous columns
+        mat L = trans(K_chol.submat(k, k, n - 1, n - 1));
+        mat U = trans(K_chol.submat(0, k, k - 1, n - 1));
+        size_t m = L.n_rows;
+        for (size_t r = 0; r < k; ++r) {
+          double *x = U.colptr(r);
+          for (size_t j = 0; j < m; ++j) {
+            double *l = L.colptr(j);
+            double h = hypot(l[j], x[j]);
+            double c = h / l[j], s = x[j] / l[j];
+            l[j] = h;
+            for (size_t i = j + 1; i < m; ++i) {
+              l[i] = (l[i] + s * x[i]) / c;
+              x[i] = c * x[i] - s * l[i];
+            }
+          }
+        }
+        K_chol = trimatu(L.t());
+      }
+      X.shed_rows(0, k - 1);
+      y.shed_rows(0, k - 1);
+    }
+
+    posterior_path sample_path(size_t n_features, rng_stream &rng) {
+      if (!dynamic_pointer_cast<kernels::squared_exponential>(kernel))
+        throw logic_error("Pathwise sampling requires a squared exponential kernel");
+      update_factor();
+
+      vector<double> params = kernel-> get_params();
+      posterior_path ans;
+      auto &path = *ans.pimpl;
+      path.sigma = params[0];
+      path.length = params[1];
+      path.X = X;
+
+      // Prior draw with random Fourier features of the squared exponential
+      path.W = rng.randn(n_features, X.n_cols) / path.length;
+      path.b = 2.0 * pi * rng.randu(1, n_features);
+      path.w = sqrt(2.0 / n_features) * path.sigma * rng.randn(n_features, 1);
+      vec prior = path.prior(X);
+      vec noise = params[2] * rng.randn(X.n_rows, 1);
+
+      // Update with the cached factor, K = R' * R
+      vec r = y - prior - noise;
+      path.v = chol_solve(K_chol, r);
+      return ans;
+    }
 
     vec eval_mean(const arma::mat& data) {
       // For the moment just use the zero mean
       return zeros<vec>(data.n_rows);
     }
 
+    // Conditional of the new points from the cached factor K = R' * R,
+    // mean = Kst * inv(K) * y and cov = Kss - V' * V with V = R' \ Kts.
     mv_gauss predict(const arma::mat& new_data) {
-      mat M = join_vert(X, new_data);
-      int n = X.n_rows, n_val = new_data.n_rows;
-      mat cov = kernel-> eval(M, M);
-      vec mean = eval_mean(M);
-      mv_gauss gd(mean, cov);
-      vector<bool> observed(n + n_val, false);
-      for (int i = 0; i < n; ++i)
-        observed[i] = true;
-      return gd.conditional(y, observed);
+      update_factor();
+      mat Kts = cross_cov(X, new_data);
+      mat V = triangular_solve(K_chol, Kts, true, true);
+      vec mean = eval_mean(new_data) +
+        Kts.t() * chol_solve(K_chol, mat(y - eval_mean(X)));
+      mat cov = kernel-> eval(new_data, new_data) - V.t() * V;
+      return mv_gauss(mean, cov);
     }
 
     mv_gauss marginal() {
@@ -39,35 +217,72 @@ namespace gplib {
       return marginal().log_density(y);
     }
 
-    static double training_obj(const vector<double> &theta, vector<double> &grad, void *fdata) {
-      implementation *pimpl = (implementation*) fdata;
-      pimpl-> kernel-> set_params(theta);
-      double ans = pimpl-> log_marginal();
+    double objective(const vector<double> &theta, vector<double> &grad) {
+      kernel-> set_params(theta);
+
+      // Log marginal and gradient from the same factorization
+      ws.K = force_symmetric(kernel-> eval(X, X));
+      robust_chol(ws.K, ws.R);
+      ws.Kinv = chol_solve(ws.R, eye<mat>(X.n_rows, X.n_rows));
+      ws.alpha = ws.Kinv * y;
+      double ans = -0.5 * (dot(y, ws.alpha) + chol_log_det(ws.R) +
+                           X.n_rows * log(2.0 * pi));
 
-      vec mx = pimpl-> eval_mean(pimpl-> X);
-      mat K = pimpl-> kernel-> eval(pimpl-> X, pimpl-> X);
-      mat Kinv = K.i();
-      vec diff = pimpl-> y;
-      mat dLLdK = -0.5 * Kinv + 0.5 * Kinv * diff * diff.t() * Kinv;
-      for (size_t d = 0; d < grad.size(); d++) {
-        mat dKdT = pimpl-> kernel-> derivate(d, pimpl-> X, pimpl-> X);
-        grad[d] = trace(dLLdK * dKdT);
+      // dLLdK is symmetric, so trace(dLLdK * dKdT) = accu(dLLdK % dKdT)
+      if (!grad.empty()) {
+        ws.dLLdK = 0.5 * (ws.alpha * ws.alpha.t() - ws.Kinv);
+        grad = kernel-> contract(ws.dLLdK, X, X, false, n_threads);
       }
       return ans;
     }
 
-    double train(int max_iter, double tol) {
-      nlopt::opt my_min(nlopt::LD_MMA, kernel-> n_params());
-      my_min.set_max_objective(implementation::training_obj, this);
-      my_min.set_xtol_rel(tol);
-      my_min.set_maxeval(max_iter);
+    // Local optimization from x, which is left at the final point
+    double optimize(vector<double> &x, const train_options &opts) {
+      double error = maximize(
+          [this](const vector<double> &theta, vector<double> &grad) {
+            return objective(theta, grad);
+          }, x, kernel-> get_lower_bounds(), kernel-> get_upper_bounds(), opts);
+      kernel-> set_params(x);
+      return error;
+    }
 
-      my_min.set_lower_bounds(kernel-> get_lower_bounds());
-      my_min.set_upper_bounds(kernel-> get_upper_bounds());
+    // The stored options with the budget and tolerance of a train call
+    train_options options_for(int max_iter, double tol) {
+      train_options opts = options;
+      opts.max_eval = max_iter;
+      opts.xtol_rel = tol;
+      return opts;
+    }
 
-      double error; //final value of error function (myfunction)
+    double train(int max_iter, double tol) {
       vector<double> x = kernel-> get_params();
-      my_min.optimize(x, error);
+      return optimize(x, options_for(max_iter, tol));
+    }
+
+    double train_multi_start(int max_iter, double tol, size_t n_starts,
+        rng_stream &rng, int design, double drop_margin) {
+      mat starts = starting_points(n_starts, kernel-> get_lower_bounds(),
+          kernel-> get_upper_bounds(), design, rng);
+
+      // Each start trains its own copy, the threads go to the starts
+      vector<implementation> copies(n_starts, *this);
+      for (size_t k = 0; k < n_starts; ++k) {
+        try {
+          copies[k].kernel = kernel-> clone();
+        } catch (const logic_error &e) {
+          throw logic_error(string("Multi-start training needs a kernel "
+                "that implements clone: ") + e.what());
+        }
+        copies[k].n_threads = 1;
+        copies[k].clear_factor();
+      }
+
+      vector<double> x;
+      double error;
+      multi_start(starts, max_iter, drop_margin,
+          [&](size_t k, vector<double> &x_k, int evals) {
+            return copies[k].optimize(x_k, options_for(evals, tol));
+          }, x, error, n_threads);
       kernel-> set_params(x);
       return error;
     }
@@ -83,6 +298,7 @@ namespace gplib {
 
   void gp_reg::set_kernel(const std::shared_ptr<kernel_class>& k) {
     pimpl-> kernel = k;
+    pimpl-> clear_factor();
   }
 
   shared_ptr<kernel_class> gp_reg::get_kernel() const {
@@ -92,19 +308,64 @@ namespace gplib {
   void gp_reg::set_training_set(const arma::mat &X, const arma::vec& y) {
     pimpl-> X = X;
     pimpl-> y = y;
+    pimpl-> clear_factor();
+  }
+
+  void gp_reg::set_threads(size_t n_threads) {
+    pimpl-> n_threads = n_threads;
+  }
+
+  void gp_reg::set_train_options(const train_options &options) {
+    pimpl-> options = options;
+  }
+
+  const train_options &gp_reg::get_train_options() const {
+    return pimpl-> options;
+  }
+
+  void gp_reg::add_observations(const mat &X, const vec &y) {
+    pimpl-> add_observations(X, y);
+  }
+
+  void gp_reg::remove_oldest(size_t n_rows) {
+    pimpl-> remove_oldest(n_rows);
+  }
+
+  void gp_reg::set_window(size_t n_rows) {
+    pimpl-> window = n_rows;
+    if (n_rows > 0 && pimpl-> X.n_rows > n_rows)
+      pimpl-> remove_oldest(pimpl-> X.n_rows - n_rows);
+  }
+
+  double gp_reg::train(const train_options &options) {
+    pimpl-> options = options;
+    return pimpl-> train(options.max_eval, options.xtol_rel);
   }
 
   double gp_reg::train(const int max_iter, double tol) {
     return pimpl-> train(max_iter, tol);
   }
 
+  double gp_reg::train(const int max_iter, const double tol,
+      const size_t n_starts, rng_stream &rng, int design, double drop_margin) {
+    return pimpl-> train_multi_start(max_iter, tol, n_starts, rng, design,
+        drop_margin);
+  }
+
   mv_gauss gp_reg::full_predict(const arma::mat &new_data) const {
+    lock_guard<mutex> lock(pimpl-> factor_lock);
     return pimpl-> predict(new_data);
   }
 
   arma::vec gp_reg::predict(const arma::mat &new_data) const {
+    lock_guard<mutex> lock(pimpl-> factor_lock);
     mv_gauss g = pimpl-> predict(new_data);
     return g.get_mean();
   }
+
+  posterior_path gp_reg::sample_path(size_t n_features, rng_stream &rng) const {
+    lock_guard<mutex> lock(pimpl-> factor_lock);
+    return pimpl-> sample_path(n_features, rng);
+  }
 };
 
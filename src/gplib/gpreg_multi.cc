@@ -1,5 +1,4 @@
 #include "gplib.hpp"
-#include <nlopt.hpp>
 #include <ctime>
 
 using namespace arma;
@@ -9,13 +8,50 @@ namespace gplib {
 
   struct gp_reg_multi::implementation {
     shared_ptr<multioutput_kernel_class> kernel;
-    vector<mat> X;
-    vector<vec> y;
+    mo_dataset data;
     vector<mat> M;
     double sigma = 0.01;
     size_t state = FULL;
+    size_t sparse_mode = FITC; // Objective of the inducing point training
+    size_t n_threads = 0; // Threads of the covariances and gradients
+    train_options options;
+
+    // Buffers of the training objectives, kept between the nlopt iterations.
+    // Expressions (products, sums) are written into their memory, matrices
+    // returned by functions (eval, force_symmetric, chol_solve) replace it
+    // and only recycle the old blocks with the ARENA=1 build.
+    struct workspace {
+      mat K, R, Kinv, dLLdK;
+      mat Kuu, Ru, Kuf, V, Pt, Rb, PtW, S;
+      vec Kff_diag, lambda, alpha, W_diag;
+      // Intrinsic coregionalization, see icm_factorize
+      mat UK, UB, Lambda, Alpha;
+      vec lK, lB;
+      // Kernel parameters and pseudo-inputs of Ru, Kuf, V and Kff_diag, the
+      // evaluations with the same ones (e.g. when only sigma moves, or the
+      // first one after retrain) skip the kernel blocks.
+      vector<double> factor_key;
+    } ws;
+
+    // Sufficient statistics of the FITC predictor, valid for the kernel
+    // parameters, pseudo-inputs and sigma in key.
+    struct fitc_stats {
+      mat Kuu, Ru, A;
+      vec b;
+      vector<double> key;
+    } stats;
+    // Held by the predictions, which fill stats and the ICM factors of ws
+    // on demand
+    cache_mutex predict_lock;
+
+    vector<double> fitc_key() {
+      vector<double> key = kernel-> get_params();
+      vector<double> flat_M = flatten(M);
+      key.insert(key.end(), flat_M.begin(), flat_M.end());
+      return key;
+    }
 
-    vec eval_mean(vector<mat> &data) {
+    vec eval_mean(const vector<mat> &data) {
       size_t total_size = 0;
       for (size_t i = 0; i < data.size(); ++i) {
         total_size += data[i].n_rows;
@@ -23,28 +59,122 @@ namespace gplib {
       return zeros<vec> (total_size);
     }
 
+    // The LMC kernel when the covariance is kron(B, K): a single latent
+    // function (intrinsic coregionalization) and the same inputs for every
+    // output. Null otherwise.
+    shared_ptr<multioutput_kernels::lmc_kernel> icm_kernel() {
+      auto lmc = dynamic_pointer_cast<multioutput_kernels::lmc_kernel>(kernel);
+      if (!lmc || lmc-> get_kernels().size() != 1)
+        return nullptr;
+      const vector<mat> &X = data.X();
+      if (X.empty() || X[0].n_rows == 0)
+        return nullptr;
+      for (size_t i = 1; i < X.size(); ++i)
+        if (X[i].n_rows != X[0].n_rows || any(vectorise(X[i] != X[0])))
+          return nullptr;
+      return lmc;
+    }
+
+    // kron(B, K) = kron(UB, UK) * diagmat(vectorise(Lambda)) * kron(UB, UK)'
+    // with Lambda(k, b) = lK(k) * lB(b), and Alpha = inv(kron(B, K)) * y
+    // with one column per output. O(N^3 + D^3) instead of O((N * D)^3).
+    // Returns log|kron(B, K)|.
+    double icm_factorize(const multioutput_kernels::lmc_kernel &lmc) {
+      const mat &X0 = data.X()[0];
+      size_t N = X0.n_rows, D = data.n_outputs();
+      ws.K = force_symmetric(lmc.get_kernels()[0]-> eval(X0, X0));
+      if (!eig_sym(ws.lK, ws.UK, ws.K) ||
+          !eig_sym(ws.lB, ws.UB, force_symmetric(lmc.get_params_k()[0])))
+        throw factorization_error("Eigendecomposition failed");
+      // Small and negative eigenvalues get the role of the jitter in
+      // robust_chol
+      ws.Lambda = ws.lK * ws.lB.t();
+      double smallest = 1e-10 * max(ws.Lambda.max(), 1.0);
+      ws.Lambda.transform([smallest](double v) { return max(v, smallest); });
+
+      mat Y = reshape(data.flat_y(), N, D);
+      ws.Alpha = ws.UK * ((ws.UK.t() * Y * ws.UB) / ws.Lambda) * ws.UB.t();
+      return accu(log(ws.Lambda));
+    }
+
+    // Exact prediction in O(N^3 + D^2 * N * n), with Z_i = K(new_i, X) * UK
+    // the covariance between outputs i and j is
+    // B(i, j) * K(new_i, new_j) - Z_i * diagmat(c_ij) * Z_j' where
+    // c_ij(k) = sum_b UB(i, b) * UB(j, b) * lB(b)^2 / Lambda(k, b).
+    mv_gauss predict_icm(const multioutput_kernels::lmc_kernel &lmc,
+        const vector<mat> &new_x) {
+      const mat &X0 = data.X()[0];
+      size_t N = X0.n_rows, D = data.n_outputs();
+      if (new_x.size() != D)
+        throw length_error("Wrong number of output classes");
+      icm_factorize(lmc);
+      const kernel_class &k = *lmc.get_kernels()[0];
+      mat B = lmc.get_params_k()[0];
+      mat AlphaB = ws.Alpha * B;
+
+      vector<size_t> first(D + 1, 0);
+      vector<mat> Z(D);
+      vec mean;
+      for (size_t i = 0; i < D; ++i) {
+        first[i + 1] = first[i] + new_x[i].n_rows;
+        if (new_x[i].n_rows == 0) {
+          Z[i] = mat(0, N);
+          continue;
+        }
+        // X goes first, so the noise of the kernel stays out of the cross
+        // covariance
+        mat Kx = k.eval(join_vert(X0, new_x[i]), X0).rows(N, N +
+            new_x[i].n_rows - 1);
+        mean = join_vert(mean, Kx * AlphaB.col(i));
+        Z[i] = Kx * ws.UK;
+      }
+
+      mat C = 1.0 / ws.Lambda;
+      C.each_row() %= square(ws.lB).t();
+      mat cov(first[D], first[D]);
+      for (size_t i = 0; i < D; ++i) {
+        for (size_t j = i; j < D; ++j) {
+          if (Z[i].n_rows == 0 || Z[j].n_rows == 0)
+            continue;
+          vec c = C * (ws.UB.row(i) % ws.UB.row(j)).t();
+          mat block = B(i, j) * k.eval(new_x[i], new_x[j]) -
+            (Z[i].each_row() % c.t()) * Z[j].t();
+          cov.submat(first[i], first[j], first[i + 1] - 1, first[j + 1] - 1) =
+            block;
+          if (j != i)
+            cov.submat(first[j], first[i], first[j + 1] - 1,
+                first[i + 1] - 1) = block.t();
+        }
+      }
+      return mv_gauss(mean, force_symmetric(cov));
+    }
+
     mv_gauss predict(const vector<mat> &new_data) {
+      auto icm = icm_kernel();
+      if (icm)
+        return predict_icm(*icm, new_data);
+      const vector<mat> &X = data.X();
       //Add new data to observations
       vector<mat> M(X.size());
-      vec fill_y;
       size_t total_rows = 0;
       for (size_t i = 0; i < X.size(); i++) {
         M[i] = join_vert (X[i], new_data[i]);
-        fill_y = join_cols<mat> (fill_y, y[i]);
-        fill_y = join_cols<mat> (fill_y, zeros<vec>(new_data[i].n_rows));
         total_rows += M[i].n_rows;
       }
 
       //Compute Covariance
-      mat cov = kernel -> eval(M, M);
+      mat cov = kernel -> eval(M, M, false, n_threads);
       //Set mean
       vec mean = eval_mean(M);
       //Set alredy observed Values
-      vector<bool> observed(mean.n_rows, false);
+      vec fill_y = zeros<vec>(total_rows);
+      vector<bool> observed(total_rows, false);
       size_t start = 0;
       for (size_t i = 0; i < M.size(); i++) {
-        for (size_t j = 0; j < X[i].n_rows; j++)
+        for (size_t j = 0; j < X[i].n_rows; j++) {
           observed[start + j] = true;
+          fill_y(start + j) = data.y()[i](j);
+        }
         start += M[i].n_rows;
       }
       //Conditon Multivariate Gaussian
@@ -52,34 +182,131 @@ namespace gplib {
       return gd.conditional(fill_y, observed);
     }
 
-    mat comp_Q(const vector<mat> &a, const vector<mat> &b, vector<mat> &u) {
-      mat kuui =  kernel-> eval(u, u).i();
-      return kernel-> eval(a, u) * kuui * kernel-> eval(u, b);
+    // Diagonal noise of the sparse approximation, R = Qff + diagmat(lambda).
+    // FITC puts the missing prior variance Kff - Qff on the diagonal, VFE
+    // only sigma and leaves Kff - Qff to the trace term of the bound.
+    vec sparse_lambda(const vec &Kff_diag, const vec &Qff_diag) {
+      if (sparse_mode == VFE)
+        return vec(Kff_diag.n_elem).fill(max(sigma, 1e-6));
+      vec lambda = Kff_diag - Qff_diag + sigma;
+      for (size_t i = 0; i < lambda.n_elem; ++i)
+        if (lambda(i) < 1e-6)
+          lambda(i) = 1e-6;
+      return lambda;
+    }
+
+    // The FITC predictor only depends on the data through
+    // A = Kuf * inv(lambda) * Kfu and b = Kuf * inv(lambda) * y, which are
+    // sums over the rows, so new batches are added without the old rows.
+    void add_to_stats(const vector<mat> &X, const vec &flat_y) {
+      //Only the diagonal of Qff is needed, with Kuu = Ru' * Ru it is the
+      //squared column norms of Ru' \ Kuf
+      mat Kuf = kernel-> eval(M, X, false, n_threads);
+      vec Qn_diag = sum(square(triangular_solve(stats.Ru, Kuf, true, true)),
+          0).t();
+      vec Kff_diag = kernel-> eval(X, X, true).diag();
+
+      vec lambda = sparse_lambda(Kff_diag, Qn_diag);
+      mat KufLi = Kuf.each_row() / lambda.t();
+      stats.A += KufLi * Kuf.t();
+      stats.b += KufLi * flat_y;
+    }
+
+    vector<double> stats_key() {
+      vector<double> key = fitc_key();
+      key.push_back(sigma);
+      return key;
+    }
+
+    void update_stats() {
+      vector<double> key = stats_key();
+      if (key == stats.key)
+        return;
+      stats.key.clear();
+      stats.Kuu = force_symmetric(kernel-> eval(M, M, false, n_threads));
+      robust_chol(stats.Kuu, stats.Ru);
+      stats.A.zeros(stats.Kuu.n_rows, stats.Kuu.n_rows);
+      stats.b.zeros(stats.Kuu.n_rows);
+      if (data.n_rows() > 0)
+        add_to_stats(data.X(), data.flat_y());
+      stats.key = key;
     }
 
     mv_gauss predict_FITC(const vector<mat> &new_x) {
-      mat Qn = force_symmetric(comp_Q(X, X, M));
-      mat Qm = force_symmetric(comp_Q(new_x, new_x, M));
-      mat Kff_diag = kernel-> eval(X, X, true);
-      mat lambda = Kff_diag - diagmat(Qn);
-      mat Kuu = kernel-> eval(M, M);
-      mat Kfu = kernel-> eval(X, M);
-      mat Kuf = kernel-> eval(M, X);
-      mat Knn = kernel-> eval(new_x, new_x);
-      mat Kun = kernel-> eval(M, new_x);
-      mat Knu = kernel-> eval(new_x, M);
-      lambda = force_diag(lambda + sigma * eye(lambda.n_rows, lambda.n_cols));
-      lambda = lambda.i();
-      mat E = (Kuu + Kuf * lambda * Kfu).i();
-      mat Y = flatten(y);
-      mat mean = Knu * E * Kuf * lambda * Y;
-      mat cov = Knn - Qm + Knu * E * Kun;
-      return mv_gauss(mean, cov);
+      update_stats();
+      mat Kun = kernel-> eval(M, new_x, false, n_threads);
+      vec Qm_diag = sum(square(triangular_solve(stats.Ru, Kun, true, true)),
+          0).t();
+      vec Knn_diag = kernel-> eval(new_x, new_x, true).diag();
+
+      //Kuu + Kuf * inv(lambda) * Kfu = R' * R, so Knu * E * Kun = V' * V
+      mat R;
+      robust_chol(force_symmetric(stats.Kuu + stats.A), R);
+      mat V = triangular_solve(R, Kun, true, true);
+      vec mean = V.t() * triangular_solve(R, stats.b, true, true);
+      //FITC predictive covariance diagmat(Knn - Qnn) + Knu * E * Kun
+      return mv_gauss::low_rank(mean, Knn_diag - Qm_diag, V.t());
+    }
+
+    // Streaming update of the FITC predictor with a batch, O(B * M^2).
+    void stream_update(const vector<mat> &new_X, const vector<vec> &new_y,
+        bool keep_rows) {
+      if (state == FULL)
+        throw logic_error("Streaming updates require a sparse model");
+      if (new_X.size() != M.size() || new_y.size() != M.size())
+        throw length_error("Wrong number of output classes");
+      update_stats();
+
+      vec flat_y;
+      for (size_t i = 0; i < new_y.size(); ++i) {
+        if (new_X[i].n_rows != new_y[i].n_elem)
+          throw length_error("Inputs and outputs have different number of rows");
+        flat_y = join_vert(flat_y, new_y[i]);
+      }
+      if (flat_y.n_elem == 0)
+        return;
+      add_to_stats(new_X, flat_y);
+
+      // The statistics do not depend on the stored rows, they stay valid
+      if (keep_rows)
+        data.append(new_X, new_y);
+    }
+
+    // Moves the predictor to new pseudo-inputs Z. The current posterior at
+    // Z, with mean m and covariance S, is kept: with K = Kzz the new
+    // statistics satisfy K * inv(K + A) * b = m and K * inv(K + A) * K = S,
+    // so A = K * inv(S) * K - K and b = K * inv(S) * m. O(M^3).
+    void refresh_inducing_points(const vector<mat> &new_M) {
+      if (state == FULL)
+        throw logic_error("Streaming updates require a sparse model");
+      if (new_M.size() != M.size())
+        throw length_error("Wrong inducing point vector size");
+      update_stats();
+
+      mat Kzu = kernel-> eval(new_M, M, false, n_threads);
+      mat K = force_symmetric(kernel-> eval(new_M, new_M, false, n_threads));
+      mat R;
+      robust_chol(force_symmetric(stats.Kuu + stats.A), R);
+      mat V = triangular_solve(R, mat(Kzu.t()), true, true);
+      mat W = triangular_solve(stats.Ru, mat(Kzu.t()), true, true);
+      vec m = V.t() * triangular_solve(R, stats.b, true, true);
+      mat S = K - W.t() * W + V.t() * V;
+
+      mat Rs;
+      robust_chol(force_symmetric(S), Rs);
+      mat T = triangular_solve(Rs, K, true, true);
+      M = new_M;
+      stats.Kuu = K;
+      robust_chol(stats.Kuu, stats.Ru);
+      stats.A = force_symmetric(T.t() * T - K);
+      stats.b = T.t() * triangular_solve(Rs, m, true, true);
+      stats.key = stats_key();
+      ws.factor_key.clear();
     }
 
     mv_gauss marginal() {
-      vec mean = eval_mean(X);
-      mat cov = kernel-> eval(X, X);
+      vec mean = zeros<vec>(data.n_rows());
+      mat cov = kernel-> eval(data.X(), data.X(), false, n_threads);
       return mv_gauss(mean, cov);
     }
 
@@ -119,161 +346,403 @@ namespace gplib {
     }
 
     double log_marginal() {
-      return marginal().log_density(flatten(y));
-    }
-
-    double log_marginal_fitc() {
-      size_t N = 0;
-      for (size_t i = 0; i < X.size(); ++i)
-        N += X[i].n_rows;
-
-      mat Qff = comp_Q (X, X, M);
-      Qff = force_symmetric(Qff);
-      mat Kff_diag = kernel-> eval(X, X, true);
-
-      mat lambda = Kff_diag - diagmat(Qff) + sigma *
-        eye<mat> (Qff.n_rows, Qff.n_cols);
-      mat B = force_diag(Qff + lambda);
-      B = chol(B);
-      double log_det = 0;
-      for (size_t i = 0; i < Qff.n_rows; ++i)
-        log_det += log(B(i, i));
-      double ans = -log_det;
-      mat flat_y = flatten (y);
-      mat tmp = (flat_y.t() * (Qff + lambda).i() * flat_y);
-      ans -= 0.5 * tmp(0,0);
-      ans -= 0.5 * N * log (2.0 * pi);
-      return ans;
+      return marginal().log_density(data.flat_y());
     }
 
-    static double training_obj(const vector<double> &theta,
-        vector<double> &grad, void *fdata) {
-
-      implementation *pimpl = (implementation*) fdata;
-      pimpl-> kernel-> set_params(theta);
-
-      double ans = pimpl-> log_marginal();
-
-      vec mx = pimpl-> eval_mean(pimpl-> X);
-      mat K = pimpl-> kernel-> eval(pimpl-> X, pimpl-> X);
-      mat Kinv = K.i();
-      vec diff = flatten(pimpl-> y);
-      mat dLLdK = -0.5 * Kinv + 0.5 * Kinv * diff * diff.t() * Kinv;
-
-      for (size_t d = 0; d < grad.size(); d++) {
-        mat dKdT = pimpl-> kernel-> derivate(d, pimpl-> X, pimpl-> X);
-        grad[d] = trace(dLLdK * dKdT);
+    // Log marginal likelihood of the intrinsic coregionalization model
+    // through the eigendecompositions of icm_factorize. The weights
+    // W = 0.5 * (alpha * alpha' - inv(kron(B, K))) only enter the gradient
+    // through G_B(i, j) = accu(W_ij % K) and W_K = sum_ij B(i, j) * W_ij,
+    // which are D x D and N x N.
+    double objective_icm(const multioutput_kernels::lmc_kernel &lmc,
+        vector<double> &grad) {
+      size_t N = data.X()[0].n_rows, D = data.n_outputs();
+      double log_det = icm_factorize(lmc);
+      double ans = -0.5 * (dot(data.flat_y(), vectorise(ws.Alpha)) + log_det +
+                           N * D * log(2.0 * pi));
+
+      if (!grad.empty()) {
+        mat Li = 1.0 / ws.Lambda;
+        vec w = Li * ws.lB, v = Li.t() * ws.lK;
+        mat B = lmc.get_params_k()[0];
+        mat G_B = 0.5 * (ws.Alpha.t() * ws.K * ws.Alpha -
+                         ws.UB * diagmat(v) * ws.UB.t());
+        mat W_K = 0.5 * (ws.Alpha * B * ws.Alpha.t() -
+                         ws.UK * diagmat(w) * ws.UK.t());
+        grad = lmc.contract_icm(G_B, W_K, data.X()[0], n_threads);
       }
-
       return ans;
     }
 
-    static double training_obj_FITC(const vector<double> &theta,
-      vector<double> &grad, void *fdata) {
-      implementation *pimpl = (implementation*) fdata;
-      pimpl-> set_params(theta);
-
-      double ans = pimpl-> log_marginal_fitc();
-
-      mat flat_y = flatten (pimpl-> y);
-      mat Qff = force_symmetric(
-                pimpl-> comp_Q (pimpl-> X, pimpl-> X, pimpl-> M));
+    double objective(const vector<double> &theta, vector<double> &grad) {
+      kernel-> set_params(theta);
+      auto icm = icm_kernel();
+      if (icm)
+        return objective_icm(*icm, grad);
+
+      // Log marginal and gradient from the same factorization
+      const vector<mat> &X = data.X();
+      const vec &flat_y = data.flat_y();
+      size_t N = data.n_rows();
+      ws.K = force_symmetric(kernel-> eval(X, X, false, n_threads));
+      robust_chol(ws.K, ws.R);
+      ws.Kinv = chol_solve(ws.R, eye<mat>(N, N));
+      ws.alpha = ws.Kinv * flat_y;
+      double ans = -0.5 * (dot(flat_y, ws.alpha) + chol_log_det(ws.R) +
+                           N * log(2.0 * pi));
+
+      // dLLdK is symmetric, so trace(dLLdK * dKdT) = accu(dLLdK % dKdT)
+      if (!grad.empty()) {
+        ws.dLLdK = 0.5 * (ws.alpha * ws.alpha.t() - ws.Kinv);
+        grad = kernel-> contract(ws.dLLdK, X, X, false, n_threads);
+      }
 
-      mat I = eye<mat> (Qff.n_rows, Qff.n_cols);
-      mat Kff_diag = pimpl-> kernel-> eval(pimpl-> X, pimpl-> X, true);
-      mat lambda = Kff_diag - diagmat (Qff) + pimpl-> sigma * I;
-      mat Ri = (Qff + lambda).i();
-      mat ytRi = flat_y.t() * Ri;
-      mat Riy = Ri * flat_y;
-      mat Kuui = (pimpl-> kernel-> eval (pimpl-> M, pimpl-> M)).i();
-      mat Kuf = pimpl-> kernel-> eval(pimpl-> M, pimpl-> X);
-      mat KuuiKuf = Kuui * Kuf;
-      mat Kfu = pimpl-> kernel-> eval(pimpl-> X, pimpl-> M);
-      mat KfuKuui = Kfu * Kuui;
+      return ans;
+    }
 
-      const vector<double> &lb = pimpl-> kernel-> get_lower_bounds();
-      const vector<double> &ub = pimpl-> kernel-> get_upper_bounds();
+    // Log marginal likelihood of FITC, or the VFE bound
+    // log N(y | 0, Qff + sigma * I) - trace(Kff - Qff) / (2 * sigma), and its
+    // gradient in a single pass. Each kernel block is evaluated once
+    // (Kfu = Kuf') and R = Qff + lambda is only handled through the Woodbury
+    // identity, so the cost is O(N * M^2) and no N x N matrix is formed.
+    double objective_FITC(const vector<double> &theta, vector<double> &grad) {
+      set_params(theta);
+
+      const vector<mat> &X = data.X();
+      const vec &flat_y = data.flat_y();
+      size_t N = data.n_rows();
+
+      // Kuu = Ru' * Ru, V = Ru' \ Kuf, so Qff = V' * V
+      vector<double> key = fitc_key();
+      if (key != ws.factor_key || ws.Kuf.n_cols != N) {
+        ws.factor_key.clear();
+        ws.Kuu = force_symmetric(kernel-> eval(M, M, false, n_threads));
+        robust_chol(ws.Kuu, ws.Ru);
+        ws.Kuf = kernel-> eval(M, X, false, n_threads);
+        ws.V = triangular_solve(ws.Ru, ws.Kuf, true, true);
+        ws.Kff_diag = kernel-> eval(X, X, true).diag();
+        ws.factor_key = key;
+      }
+      vec Qff_diag = sum(square(ws.V), 0).t();
+      ws.lambda = sparse_lambda(ws.Kff_diag, Qff_diag);
+
+      // R = V' * V + diagmat(lambda), with B = I + V * inv(lambda) * V'
+      // log|R| = log|lambda| + log|B| and V * inv(R) = B \ (V * inv(lambda))
+      mat VL = ws.V.each_row() / ws.lambda.t();
+      mat B = eye<mat>(ws.V.n_rows, ws.V.n_rows) + VL * ws.V.t();
+      robust_chol(force_symmetric(B), ws.Rb);
+      vec yl = flat_y / ws.lambda;
+      ws.alpha = yl - (ws.V.t() * chol_solve(ws.Rb, mat(ws.V * yl))) / ws.lambda;
+
+      double ans = -0.5 * (dot(flat_y, ws.alpha) + accu(log(ws.lambda)) +
+                           chol_log_det(ws.Rb) + N * log(2.0 * pi));
+      double noise = ws.lambda.n_elem > 0 ? ws.lambda(0) : sigma;
+      double trace = accu(ws.Kff_diag - Qff_diag);
+      if (sparse_mode == VFE)
+        ans -= 0.5 * trace / noise;
+      if (grad.empty())
+        return ans;
+
+      // grad_d = accu(W % dRdT) with W = 0.5 * (alpha * alpha' - inv(R)) and
+      // dRdT = offdiag(dQffdT) + dKffdT_diag, where
+      // dQffdT = P * dKufdT - P * dKuudT * P' + dKfudT * P' and P = Kfu * Kuui.
+      // Moving P to the weights gives one contraction per kernel block, the
+      // weights only need P' * W, P' * W * P and diag(W).
+      // VFE has dRdT = dQffdT and the trace term adds I / (2 * sigma) to the
+      // weight of dQffdT and -1 / (2 * sigma) to the one of dKffdT_diag, so
+      // both objectives share the contractions below with other weights.
+      mat C = triangular_solve(ws.Rb, ws.V, true, true);
+      vec Ri_diag = 1.0 / ws.lambda -
+        sum(square(C), 0).t() / square(ws.lambda);
+      vec W_diag = 0.5 * (square(ws.alpha) - Ri_diag);
+      vec Q_shift;  // Weight of dQffdT is W + diagmat(Q_shift)
+      // FITC entries of lambda held at the floor do not move, there the
+      // diagonal of dRdT is only the one of dQffdT.
+      vec moving = ones<vec>(N);
+      if (sparse_mode == VFE) {
+        ws.W_diag.set_size(N);
+        ws.W_diag.fill(-0.5 / noise);
+        Q_shift = -ws.W_diag;
+      } else {
+        moving.elem(find(ws.Kff_diag - Qff_diag + sigma < 1e-6)).zeros();
+        ws.W_diag = W_diag % moving;
+        Q_shift = -ws.W_diag;
+      }
+      ws.Pt = triangular_solve(ws.Ru, ws.V);  // Kuui * Kuf
+      mat PtRi = triangular_solve(ws.Ru, chol_solve(ws.Rb, VL));
+      vec Pt_alpha = ws.Pt * ws.alpha;
+      // P' * (W + diagmat(Q_shift))
+      ws.PtW = 0.5 * (Pt_alpha * ws.alpha.t() - PtRi);
+      ws.PtW += ws.Pt.each_row() % Q_shift.t();
+      ws.S = ws.PtW * ws.Pt.t();
+
+      // The derivative blocks of the parameter matrices are not symmetric
+      // under transposition, so both orientations of Kuf are contracted.
+      vector<double> g_uf = kernel-> contract(ws.PtW, M, X, false, n_threads);
+      vector<double> g_fu = kernel-> contract(mat(ws.PtW.t()), X, M, false,
+          n_threads);
+      vector<double> g_uu = kernel-> contract(ws.S, M, M, false, n_threads);
+      vector<double> g_ff = kernel-> contract(ws.W_diag, X, X, true,
+          n_threads);
+
+      const vector<double> &lb = kernel-> get_lower_bounds();
+      const vector<double> &ub = kernel-> get_upper_bounds();
+      size_t n_kernel = kernel-> n_params();
+      // The low-rank parameter matrices have exact derivatives, they are
+      // not doubled.
+      size_t n_doubled = kernel-> get_kernels().size() * X.size() * X.size();
+      auto lmc = dynamic_pointer_cast<multioutput_kernels::lmc_kernel>(kernel);
+      if (lmc && lmc-> get_rank() > 0)
+        n_doubled = 0;
 
       for (size_t d = 0; d < grad.size(); d++) {
         if (d < lb.size() && ub[d] <= lb[d]) {
            grad[d] = 0;
            continue;
         }
-        mat dRdT;
-        if(d + 1 < grad.size()) {
-          mat dKfudT = pimpl-> kernel-> derivate (d, pimpl-> X, pimpl-> M);
-          mat dKuudT = pimpl-> kernel-> derivate (d, pimpl-> M, pimpl-> M);
-          mat dKufdT = pimpl-> kernel-> derivate (d, pimpl-> M, pimpl-> X);
-          mat dQffdT = KfuKuui * (dKufdT - dKuudT * KuuiKuf) + dKfudT * KuuiKuf;
-          mat dKffdT_diag;
-          //If it is one of the pseudo-inputs dKff should be 0
-          if (d > pimpl-> kernel-> n_params())
-            dKffdT_diag = zeros<mat>(Qff.n_rows, Qff.n_cols);
-          else
-            dKffdT_diag = pimpl-> kernel-> derivate (d, pimpl-> X, pimpl-> X, true);
-          dRdT = dQffdT + dKffdT_diag - diagmat(dQffdT);
-
-        } else { // Special case for sigma.
-          dRdT = 2 * sqrt(pimpl-> sigma) * I;
+        if (d < n_kernel) {
+          grad[d] = g_uf[d] + g_fu[d] - g_uu[d] + g_ff[d];
+        } else if(d + 1 < grad.size()) { // Pseudo-inputs, filled below
+          continue;
+        } else if (sparse_mode == VFE) { // Sigma, dRdT = I unless floored
+          grad[d] = sigma < 1e-6 ? 0.0 :
+            accu(W_diag) + trace / (2.0 * noise * noise);
+        } else { // Special case for sigma, dRdT = diagmat(moving).
+          grad[d] = dot(W_diag, moving);
         }
 
-        double t = accu(Ri % dRdT); // trace(Ri * dRdT);
-        mat ans = -t + ytRi * dRdT * Riy;
-
-        grad[d]  = 0.5 * ans(0,0);
-        if (d < pimpl-> kernel-> get_kernels().size() * pimpl-> X.size() * pimpl-> X.size()) {
+        if (d < n_doubled) {
           grad[d] *= 2;
         }
       }
+
+      if (grad.size() > n_kernel + 1)
+        pseudo_input_gradient(grad, n_kernel);
       return ans;
     }
 
+    // Only column m of Kfu and row and column m of Kuu depend on the
+    // pseudo-input m, so with the compact derivatives G_fu = dKfu / dM and
+    // G_uu = dKuu / dM the gradient wrt M(m, c) is
+    // 2 * sum_i PtW(m, i) * G_fu(i, m, c) - 2 * sum_j S(j, m) * G_uu(j, m, c),
+    // with S = P' * W_off * P. This is O(N * M * D) for all of them.
+    void pseudo_input_gradient(vector<double> &grad, size_t first) {
+      const vector<mat> &X = data.X();
+      cube G_fu = kernel-> derivate_wrt_inputs(X, M);
+      cube G_uu = kernel-> derivate_wrt_inputs(M, M);
+      mat G(G_fu.n_cols, G_fu.n_slices);
+      parallel_for(0, G.n_cols, [&](size_t c) {
+        G.col(c) = 2.0 * (sum(ws.PtW.t() % G_fu.slice(c), 0) -
+                          sum(ws.S % G_uu.slice(c), 0)).t();
+      }, n_threads);
+
+      // Same row major order as flatten(M)
+      size_t d = first, first_row = 0;
+      for (size_t j = 0; j < M.size(); ++j) {
+        for (size_t m = 0; m < M[j].n_rows; ++m)
+          for (size_t c = 0; c < M[j].n_cols; ++c)
+            grad[d++] = G(first_row + m, c);
+        first_row += M[j].n_rows;
+      }
+    }
 
-    double train(int max_iter, double tol) {
-      nlopt::opt best(nlopt::LD_MMA, kernel-> n_params());
-      best.set_max_objective(implementation::training_obj, this);
-      best.set_xtol_rel(tol);
-      best.set_maxeval(max_iter);
-
-      best.set_lower_bounds(kernel-> get_lower_bounds());
-      best.set_upper_bounds(kernel-> get_upper_bounds());
+    // Objective of the current model and its gradient wrt the parameters
+    // that train moves, left empty without with_grad.
+    double current_objective(vector<double> &grad, bool with_grad) {
+      vector<double> theta = state == FULL ? kernel-> get_params() :
+        get_all_params();
+      grad.assign(with_grad ? theta.size() : 0, 0.0);
+      if (state == FULL)
+        return objective(theta, grad);
+      return objective_FITC(theta, grad);
+    }
 
-      double error; //final value of error function
-      vector<double> x = kernel-> get_params();
-      best.optimize(x, error);
+    // Local optimizations from x, which is left at the final point
+    double optimize(vector<double> &x, const train_options &opts) {
+      double error = maximize(
+          [this](const vector<double> &theta, vector<double> &grad) {
+            return objective(theta, grad);
+          }, x, kernel-> get_lower_bounds(), kernel-> get_upper_bounds(), opts);
       kernel-> set_params(x);
       return error;
     }
 
-    double train_FITC(int max_iter, double tol, bool opt_pi) {
+    double optimize_FITC(vector<double> &x, const train_options &opts,
+        bool opt_pi) {
       size_t M_size = 0;
       if (opt_pi)
         for (size_t i = 0; i < M.size(); ++i)
           M_size += M[i].size();
-      size_t n_params = kernel-> n_params() + M_size + 1; // added sigma
-      nlopt::opt best(nlopt::LD_MMA, n_params);
-      best.set_max_objective(implementation::training_obj_FITC, this);
-      best.set_xtol_rel(tol);
-      best.set_maxeval(max_iter);
       vector<double> lb = kernel-> get_lower_bounds();
       vector<double> ub = kernel-> get_upper_bounds();
       if (opt_pi){
         lb.resize(lb.size() + M_size, -HUGE_VAL);
         ub.resize(ub.size() + M_size, HUGE_VAL);
       }
-      lb.push_back(0.0);
+      lb.push_back(0.0); // sigma
       ub.push_back(HUGE_VAL);
-      best.set_lower_bounds(lb);
-      best.set_upper_bounds(ub);
 
-      double error; //final value of error function
+      double error = maximize(
+          [this](const vector<double> &theta, vector<double> &grad) {
+            return objective_FITC(theta, grad);
+          }, x, lb, ub, opts);
+      set_params(x);
+      return error;
+    }
+
+    // The k initial pseudo-inputs of the output class i, placed as
+    // options.inducing_init says.
+    mat initial_inducing(size_t i, size_t k) {
+      const mat &Xi = data.X()[i];
+      if (options.inducing_init == KMEANS) {
+        rng_stream rng(options.seed, i);
+        return kmeans_points(Xi, k, rng, 10, n_threads);
+      }
+      if (options.inducing_init != PIVOTED_CHOLESKY)
+        return grid_points(Xi, k);
+
+      // The kernel restricted to the class i, the columns put the pivot in
+      // the first row so the noise of the cross evaluation is dropped.
+      vector<mat> a(data.n_outputs(), mat(0, Xi.n_cols)), b = a;
+      vec diag(Xi.n_rows);
+      parallel_for(0, Xi.n_rows, [&](size_t r) {
+        vector<mat> x(a);
+        x[i] = Xi.row(r);
+        diag(r) = kernel-> eval(x, x, true)(0, 0);
+      }, n_threads);
+      return pivoted_cholesky_points(Xi, k, diag, [&](size_t j) {
+        a[i] = join_vert(Xi.row(j), Xi);
+        b[i] = Xi.row(j);
+        mat col = kernel-> eval(a, b, false, n_threads);
+        return vec(col.col(0).tail(Xi.n_rows));
+      });
+    }
+
+    // The stored options with the budget and tolerance of a train call
+    train_options options_for(int max_iter, double tol) {
+      train_options opts = options;
+      opts.max_eval = max_iter;
+      opts.xtol_rel = tol;
+      return opts;
+    }
+
+    double train(int max_iter, double tol) {
+      vector<double> x = kernel-> get_params();
+      return optimize(x, options_for(max_iter, tol));
+    }
+
+    // Adds the columns of the new rows to the cached Kuf, V and Kff_diag,
+    // old_offsets are the class offsets before data.append.
+    void extend_fitc_cache(const vector<mat> &new_X,
+        const vector<size_t> &old_offsets) {
+      size_t N = data.n_rows();
+      mat Kuf_new = kernel-> eval(M, new_X, false, n_threads);
+      mat V_new = triangular_solve(ws.Ru, Kuf_new, true, true);
+      vec Kff_new = kernel-> eval(new_X, new_X, true).diag();
+
+      mat Kuf(ws.Kuf.n_rows, N), V(ws.V.n_rows, N);
+      vec Kff_diag(N);
+      size_t first_new = 0;
+      for (size_t i = 0; i < new_X.size(); ++i) {
+        size_t first = data.offset(i);
+        size_t n_old = old_offsets[i + 1] - old_offsets[i];
+        size_t n_new = new_X[i].n_rows;
+        if (n_old > 0) {
+          span to(first, first + n_old - 1);
+          span from(old_offsets[i], old_offsets[i + 1] - 1);
+          Kuf.cols(to) = ws.Kuf.cols(from);
+          V.cols(to) = ws.V.cols(from);
+          Kff_diag(to) = ws.Kff_diag(from);
+        }
+        if (n_new > 0) {
+          span to(first + n_old, first + n_old + n_new - 1);
+          span from(first_new, first_new + n_new - 1);
+          Kuf.cols(to) = Kuf_new.cols(from);
+          V.cols(to) = V_new.cols(from);
+          Kff_diag(to) = Kff_new(from);
+        }
+        first_new += n_new;
+      }
+      ws.Kuf.swap(Kuf);
+      ws.V.swap(V);
+      ws.Kff_diag.swap(Kff_diag);
+    }
+
+    // Appends the rows and continues the optimization from the current
+    // state. In FITC the pseudo-inputs and sigma are kept and, when the
+    // cached factor matches the current parameters, only the new rows are
+    // evaluated by the first objective call.
+    double retrain(const vector<mat> &new_X, const vector<vec> &new_y,
+        int max_iter, double tol, bool opt_pi) {
+      vector<size_t> old_offsets;
+      for (size_t i = 0; i <= data.n_outputs(); ++i)
+        old_offsets.push_back(i < data.n_outputs() ? data.offset(i) :
+                              data.n_rows());
+      bool extend = state != FULL && !ws.factor_key.empty() &&
+        ws.factor_key == fitc_key() && ws.Kuf.n_cols == data.n_rows();
+
+      data.append(new_X, new_y);
+      // The predictor statistics do not have the new rows, even when the
+      // parameters do not move
+      stats.key.clear();
+      if (extend && old_offsets.size() == data.n_outputs() + 1)
+        extend_fitc_cache(new_X, old_offsets);
+      else
+        ws.factor_key.clear();
+
+      if (state != FULL)
+        return train_FITC(max_iter, tol, opt_pi);
+      return train(max_iter, tol);
+    }
+
+    double train_FITC(int max_iter, double tol, bool opt_pi) {
       vector<double> x;
       if (opt_pi)
         x = get_all_params();
       else
         x = get_params();
-      best.optimize(x, error);
-      set_params(x);
+      return optimize_FITC(x, options_for(max_iter, tol), opt_pi);
+    }
+
+    // The kernel parameters of each start are drawn inside the bounds, in
+    // FITC sigma and the pseudo-inputs start from their current values.
+    double train_multi_start(int max_iter, double tol, size_t n_starts,
+        rng_stream &rng, int design, double drop_margin, bool opt_pi) {
+      mat starts = starting_points(n_starts, kernel-> get_lower_bounds(),
+          kernel-> get_upper_bounds(), design, rng);
+      if (state != FULL) {
+        vector<double> rest = opt_pi ? get_all_params() : get_params();
+        rest.erase(rest.begin(), rest.begin() + kernel-> n_params());
+        starts.resize(n_starts, starts.n_cols + rest.size());
+        for (size_t c = 0; c < rest.size(); ++c)
+          starts.col(kernel-> n_params() + c).fill(rest[c]);
+      }
+
+      // Each start trains its own copy, the threads go to the starts
+      vector<implementation> copies(n_starts, *this);
+      for (size_t k = 0; k < n_starts; ++k) {
+        try {
+          copies[k].kernel = kernel-> clone();
+        } catch (const logic_error &e) {
+          throw logic_error(string("Multi-start training needs a kernel "
+                "that implements clone: ") + e.what());
+        }
+        copies[k].n_threads = 1;
+      }
+
+      vector<double> x;
+      double error;
+      multi_start(starts, max_iter, drop_margin,
+          [&](size_t k, vector<double> &x_k, int evals) {
+            train_options opts = options_for(evals, tol);
+            if (state != FULL)
+              return copies[k].optimize_FITC(x_k, opts, opt_pi);
+            return copies[k].optimize(x_k, opts);
+          }, x, error, n_threads);
+      if (state != FULL)
+        set_params(x);
+      else
+        kernel-> set_params(x);
       return error;
     }
 
@@ -289,13 +758,48 @@ namespace gplib {
 
   void gp_reg_multi::set_kernel(const shared_ptr<multioutput_kernel_class> &k) {
     pimpl-> kernel = k;
+    pimpl-> ws.factor_key.clear();
+    pimpl-> stats.key.clear();
   }
 
   void gp_reg_multi::set_training_set(const vector<mat> &X,
       const vector<vec> &y) {
 
-    pimpl-> X = X;
-    pimpl-> y = y;
+    pimpl-> data.set(X, y);
+    pimpl-> ws.factor_key.clear();
+    pimpl-> stats.key.clear();
+  }
+
+  void gp_reg_multi::set_training_set(const mo_dataset &data) {
+    pimpl-> data = data;
+    pimpl-> ws.factor_key.clear();
+    pimpl-> stats.key.clear();
+  }
+
+  void gp_reg_multi::set_threads(size_t n_threads) {
+    pimpl-> n_threads = n_threads;
+  }
+
+  void gp_reg_multi::set_sparse_mode(int mode) {
+    if (mode != FITC && mode != VFE)
+      throw logic_error("Unknown sparse mode");
+    pimpl-> sparse_mode = mode;
+    if (pimpl-> state != FULL)
+      pimpl-> state = mode;
+    pimpl-> stats.key.clear();
+  }
+
+  void gp_reg_multi::set_train_options(const train_options &options) {
+    pimpl-> options = options;
+  }
+
+  const train_options &gp_reg_multi::get_train_options() const {
+    return pimpl-> options;
+  }
+
+  double gp_reg_multi::train(const train_options &options) {
+    pimpl-> options = options;
+    return pimpl-> train(options.max_eval, options.xtol_rel);
   }
 
   double gp_reg_multi::train(const int max_iter, const double tol) {
@@ -304,91 +808,64 @@ namespace gplib {
 
   double gp_reg_multi::train(const int max_iter, const double tol,
     const size_t num_pi, bool opt_pi) {
+    const vector<mat> &X = pimpl-> data.X();
     //Initial check
-    if (pimpl-> X.size() == 0 || pimpl-> X[0].size() == 0)
+    if (X.size() == 0 || X[0].size() == 0)
       throw logic_error("Parameters Uninitialized");
 
-    pimpl-> M = vector<mat>(pimpl-> X.size());
-    for (size_t i = 0; i < pimpl-> X.size(); ++i) {
+    pimpl-> M = vector<mat>(X.size());
+    for (size_t i = 0; i < X.size(); ++i) {
       //Check for too many inducing points
-      if (num_pi > pimpl-> X[i].n_rows)
+      if (num_pi > X[i].n_rows)
         throw length_error("Too many inducing points");
-      //Initial matrix
-      pimpl-> M[i] = zeros<mat>(num_pi, pimpl-> X[i].n_cols);
-      //Fill matrix
-      for (size_t j = 0; j < pimpl-> X[i].n_cols; ++j) {
-        double col_max = pimpl-> X[i].col(j).max();
-        double col_min = pimpl-> X[i].col(j).min();
-        double step = (col_max - col_min) / num_pi;
-        double cur = col_min;
-        for (size_t k = 0; k < num_pi; ++k) {
-          if (cur > col_max)
-            pimpl-> M[i](k, j) = col_max;
-          else
-            pimpl-> M[i](k, j) = cur;
-          cur += step;
-        }
-      }
+      pimpl-> M[i] = pimpl-> initial_inducing(i, num_pi);
     }
-    pimpl-> state = FITC;
+    pimpl-> state = pimpl-> sparse_mode;
     return pimpl-> train_FITC(max_iter, tol, opt_pi);
   }
 
   double gp_reg_multi::train(const int max_iter, const double tol,
     const vector<size_t> num_pi, bool opt_pi) {
+    const vector<mat> &X = pimpl-> data.X();
     //Initial check
-    if (pimpl-> X.size() == 0 || pimpl-> X[0].size() == 0)
+    if (X.size() == 0 || X[0].size() == 0)
       throw logic_error("Parameters Uninitialized");
-    if (num_pi.size() != pimpl-> X.size())
+    if (num_pi.size() != X.size())
       throw length_error("Wrong inducing point vector size");
 
-    pimpl-> M = vector<mat>(pimpl-> X.size());
-    for (size_t i = 0; i < pimpl-> X.size(); ++i) {
+    pimpl-> M = vector<mat>(X.size());
+    for (size_t i = 0; i < X.size(); ++i) {
       //Check for too many inducing points
-      if (num_pi[i] >= pimpl-> X[i].n_rows)
+      if (num_pi[i] >= X[i].n_rows)
         throw length_error("Too many inducing points");
-      //Create initial matrix
-      pimpl-> M[i] = zeros<mat>(num_pi[i], pimpl-> X[i].n_cols);
-      //Fill matrix
-      for (size_t j = 0; j < pimpl-> X[i].n_cols; ++j) {
-        double col_max = pimpl-> X[i].col(j).max();
-        double col_min = pimpl-> X[i].col(j).min();
-        double step = (col_max - col_min) / num_pi[i];
-        double cur = col_min;
-        for (size_t k = 0; k < num_pi[i]; ++k) {
-          if (cur > col_max)
-            pimpl-> M[i](k, j) = col_max;
-          else
-            pimpl-> M[i](k, j) = cur;
-          cur += step;
-        }
-      }
+      pimpl-> M[i] = pimpl-> initial_inducing(i, num_pi[i]);
     }
-    pimpl-> state = FITC;
+    pimpl-> state = pimpl-> sparse_mode;
     return pimpl-> train_FITC(max_iter, tol, opt_pi);
   }
 
   double gp_reg_multi::train(const int max_iter, const double tol,
     const vector<mat> num_pi, bool opt_pi) {
+    const vector<mat> &X = pimpl-> data.X();
     //Initial check
-    if (pimpl-> X.size() == 0 || pimpl-> X[0].size() == 0)
+    if (X.size() == 0 || X[0].size() == 0)
       throw logic_error("Parameters Uninitialized");
-    if (num_pi.size() != pimpl-> X.size())
+    if (num_pi.size() != X.size())
       throw length_error("Wrong inducing point vector size");
 
-    for (size_t i = 0; i < pimpl-> X.size(); ++i) {
+    for (size_t i = 0; i < X.size(); ++i) {
       //Check for too many inducing points
-      if (num_pi[i].n_rows >= pimpl-> X[i].n_rows)
+      if (num_pi[i].n_rows >= X[i].n_rows)
         throw length_error("Too many inducing points");
       if (num_pi[i].size() == 0)
         throw length_error("No inducing points assigned");
       //Check inducing points dimension
-      if (num_pi[i].n_cols != pimpl-> X[i].n_cols)
+      if (num_pi[i].n_cols != X[i].n_cols)
         throw logic_error("Inducing points dimension mismatched");
       //Check range of inducing points
-      for (size_t j = 0; j < pimpl-> X[i].n_cols; ++j) {
-        double col_X_max = pimpl-> X[i].col(j).max();
-        double col_X_min = pimpl-> X[i].col(j).min();
+      for (size_t j = 0; j < X[i].n_cols; ++j) {
+        double col_X_max = X[i].col(j).max();
+        double col_X_min = X[i].col(j).min();
         double col_pi_max = num_pi[i].col(j).max();
         double col_pi_min = num_pi[i].col(j).min();
         if (col_pi_max > col_X_max or col_pi_min < col_X_min)
@@ -396,26 +873,59 @@ namespace gplib {
       }
     }
     pimpl-> M = num_pi;
-    pimpl-> state = FITC;
+    pimpl-> state = pimpl-> sparse_mode;
     return pimpl-> train_FITC(max_iter, tol, opt_pi);
   }
 
+  double gp_reg_multi::train(const int max_iter, const double tol,
+      const size_t n_starts, rng_stream &rng, int design, double drop_margin,
+      bool opt_pi) {
+    return pimpl-> train_multi_start(max_iter, tol, n_starts, rng, design,
+        drop_margin, opt_pi);
+  }
+
+  double gp_reg_multi::retrain(const vector<mat> &new_X,
+      const vector<vec> &new_y, const int max_iter, const double tol,
+      bool opt_pi) {
+    return pimpl-> retrain(new_X, new_y, max_iter, tol, opt_pi);
+  }
+
+  void gp_reg_multi::stream_update(const vector<mat> &new_X,
+      const vector<vec> &new_y, bool keep_rows) {
+    pimpl-> stream_update(new_X, new_y, keep_rows);
+  }
+
+  void gp_reg_multi::refresh_inducing_points(const vector<mat> &new_M) {
+    pimpl-> refresh_inducing_points(new_M);
+  }
+
   mv_gauss gp_reg_multi::full_predict(const vector<mat> &new_data) {
-    if (pimpl-> state == FITC)
+    lock_guard<mutex> lock(pimpl-> predict_lock);
+    if (pimpl-> state != FULL)
       return pimpl-> predict_FITC(new_data);
     else
       return pimpl-> predict(new_data);
   }
 
   arma::vec gp_reg_multi::predict(const vector<arma::mat> &new_data) const {
+    lock_guard<mutex> lock(pimpl-> predict_lock);
     mv_gauss g;
-    if (pimpl-> state == FITC)
+    if (pimpl-> state != FULL)
       g = pimpl-> predict_FITC(new_data);
     else
       g = pimpl-> predict(new_data);
     return g.get_mean();
   }
 
+  double gp_reg_multi::objective() {
+    vector<double> grad;
+    return pimpl-> current_objective(grad, false);
+  }
+
+  double gp_reg_multi::objective(vector<double> &grad) {
+    return pimpl-> current_objective(grad, true);
+  }
+
   vector<double> gp_reg_multi::get_params() const {
     return pimpl-> get_params();
   }
@@ -0,0 +1,137 @@
+#include "gplib.hpp"
+
+using namespace arma;
+using namespace std;
+
+namespace gplib {
+
+  namespace {
+    const size_t chunk = 1024; // Rows per parallel task
+
+    // Squared distances from the rows of X to c.
+    vec squared_distances(const mat &X, const rowvec &c) {
+      mat diff = X.each_row() - c;
+      return sum(square(diff), 1);
+    }
+  };
+
+  mat grid_points(const mat &X, size_t k) {
+    mat ans = zeros<mat>(k, X.n_cols);
+    for (size_t j = 0; j < X.n_cols; ++j) {
+      double col_max = X.col(j).max();
+      double col_min = X.col(j).min();
+      double step = (col_max - col_min) / k;
+      double cur = col_min;
+      for (size_t r = 0; r < k; ++r) {
+        if (cur > col_max)
+          ans(r, j) = col_max;
+        else
+          ans(r, j) = cur;
+        cur += step;
+      }
+    }
+    return ans;
+  }
+
+  mat kmeans_points(const mat &X, size_t k, rng_stream &rng, size_t n_iter,
+      size_t n_threads) {
+    size_t n = X.n_rows;
+    if (k > n)
+      throw length_error("Too many inducing points");
+    mat centers(k, X.n_cols);
+    if (k == 0)
+      return centers;
+    size_t n_chunks = (n + chunk - 1) / chunk;
+    auto rows = [&](size_t t) {
+      return arma::span(t * chunk, min(n, (t + 1) * chunk) - 1);
+    };
+
+    // Seeding, each new center is drawn with probability proportional to
+    // the squared distance to the closest center so far.
+    size_t first = min(n - 1, (size_t) (rng.randu(1, 1)(0, 0) * n));
+    centers.row(0) = X.row(first);
+    vec dist = squared_distances(X, centers.row(0));
+    vec partial(n_chunks);
+    for (size_t c = 1; c < k; ++c) {
+      parallel_for(0, n_chunks, [&](size_t t) {
+        partial(t) = accu(dist(rows(t)));
+      }, n_threads);
+      double target = rng.randu(1, 1)(0, 0) * accu(partial);
+      size_t pick = n - 1;
+      double acc = 0;
+      for (size_t i = 0; i < n; ++i) {
+        acc += dist(i);
+        if (acc > target) {
+          pick = i;
+          break;
+        }
+      }
+      centers.row(c) = X.row(pick);
+      parallel_for(0, n_chunks, [&](size_t t) {
+        arma::span r = rows(t);
+        vec old = dist(r);
+        dist(r) = arma::min(old, squared_distances(X.rows(r), centers.row(c)));
+      }, n_threads);
+    }
+
+    // Lloyd iterations, each chunk keeps its own sums
+    vector<mat> sums(n_chunks);
+    vector<vec> counts(n_chunks);
+    rowvec c_norms;
+    for (size_t it = 0; it < n_iter; ++it) {
+      c_norms = sum(square(centers), 1).t();
+      parallel_for(0, n_chunks, [&](size_t t) {
+        arma::span r = rows(t);
+        mat d = -2.0 * X.rows(r) * centers.t();
+        d.each_row() += c_norms;
+        sums[t].zeros(k, X.n_cols);
+        counts[t].zeros(k);
+        for (size_t i = 0; i < d.n_rows; ++i) {
+          uword best = d.row(i).index_min();
+          sums[t].row(best) += X.row(r.a + i);
+          counts[t](best) += 1;
+        }
+      }, n_threads);
+
+      mat total = zeros<mat>(k, X.n_cols);
+      vec count = zeros<vec>(k);
+      for (size_t t = 0; t < n_chunks; ++t) {
+        total += sums[t];
+        count += counts[t];
+      }
+      for (size_t c = 0; c < k; ++c)
+        if (count(c) > 0) // Empty clusters keep their center
+          centers.row(c) = total.row(c) / count(c);
+    }
+    return centers;
+  }
+
+  mat pivoted_cholesky_points(const mat &X, size_t k, const vec &diag,
+      const function<vec(size_t)> &column) {
+    size_t n = X.n_rows;
+    if (k > n)
+      throw length_error("Too many inducing points");
+    vec d = diag;
+    mat L = zeros<mat>(n, k);
+    uvec pivots(k);
+    vector<bool> chosen(n, false);
+    for (size_t m = 0; m < k; ++m) {
+      size_t j = n;
+      for (size_t i = 0; i < n; ++i)
+        if (!chosen[i] && (j == n || d(i) > d(j)))
+          j = i;
+      pivots(m) = j;
+      chosen[j] = true;
+      if (d(j) <= 0) // Nothing left to explain, the rest are picked in order
+        continue;
+
+      vec l = column(j);
+      if (m > 0)
+        l -= L.cols(0, m - 1) * L.row(j).cols(0, m - 1).t();
+      l /= sqrt(d(j));
+      L.col(m) = l;
+      d -= square(l);
+    }
+    return X.rows(pivots);
+  }
+};
@@ -0,0 +1,57 @@
+#ifndef GPLIB_INDUCING
+#define GPLIB_INDUCING
+
+#include "arena.hpp"
+
+#include <armadillo>
+#include <functional>
+
+#include "random.hpp"
+
+namespace gplib {
+
+  /**
+   *  Placement of the inducing points when only their number is given.
+   *  GRID             : Uniform grid along each column of the inputs.
+   *  KMEANS           : Centers of k-means++ on the inputs.
+   *  PIVOTED_CHOLESKY : Inputs chosen greedily by the largest remaining
+   *                     prior variance (pivoted Cholesky of the kernel).
+   **/
+  enum inducing_init {GRID, KMEANS, PIVOTED_CHOLESKY};
+
+  /**
+   *  Returns k points on a uniform grid along each column of X, the
+   *  placement used by train before the other initializers existed.
+   **/
+  arma::mat grid_points(const arma::mat &X, size_t k);
+
+  /**
+   *  Returns the k centers found by k-means++ seeding followed by Lloyd
+   *  iterations. The distance updates and the assignments run on the
+   *  library thread pool and their sums are reduced in a fixed order.
+   *  @param X : Inputs, one per row.
+   *  @param k : Number of centers, at most X.n_rows.
+   *  @param rng : Stream used by the seeding.
+   *  @param n_iter : Number of Lloyd iterations.
+   *  @param n_threads : Maximum number of threads, 0 means default_threads().
+   *  @ref : http://ilpubs.stanford.edu:8090/778/1/2006-13.pdf
+   **/
+  arma::mat kmeans_points(const arma::mat &X, size_t k, rng_stream &rng,
+      size_t n_iter = 10, size_t n_threads = 0);
+
+  /**
+   *  Returns the rows of X chosen by a pivoted Cholesky factorization of
+   *  the kernel matrix K(X, X), each step takes the input with the largest
+   *  variance left unexplained by the ones already chosen. It costs k
+   *  kernel columns and O(N * k^2).
+   *  @param X : Inputs, one per row.
+   *  @param k : Number of points, at most X.n_rows.
+   *  @param diag : Diagonal of K(X, X).
+   *  @param column : column(j) returns K(X, X.row(j)).
+   *  @ref : https://arxiv.org/abs/1903.03571
+   **/
+  arma::mat pivoted_cholesky_points(const arma::mat &X, size_t k,
+      const arma::vec &diag, const std::function<arma::vec(size_t)> &column);
+};
+
+#endif
@@ -4,6 +4,52 @@ using namespace arma;
 using namespace std;
 
 namespace gplib {
+  vector<double> kernel_class::contract(const mat &W, const mat &X,
+      const mat &Y, bool diag,
+      size_t n_threads) const {
+    // Each parameter writes its own slot
+    vector<double> ans(n_params());
+    parallel_for(0, ans.size(), [&](size_t d) {
+      if (diag)
+        ans[d] = dot(W, derivate(d, X, Y, true).diag());
+      else
+        ans[d] = accu(W % derivate(d, X, Y));
+    }, n_threads);
+    return ans;
+  }
+
+  cube kernel_class::derivate_wrt_inputs(const mat &X, const mat &Z) const {
+    if (Z.size() > X.size())
+      throw logic_error("The inputs to derivate must be the smaller matrix");
+    cube ans(X.n_rows, Z.n_rows, Z.n_cols);
+    for (size_t m = 0; m < Z.n_rows; ++m)
+      for (size_t c = 0; c < Z.n_cols; ++c)
+        ans.slice(c).col(m) =
+          derivate(n_params() + m * Z.n_cols + c, X, Z).col(m);
+    return ans;
+  }
+
+  bool kernel_class::isotropic() const {
+    return false;
+  }
+
+  mat kernel_class::eval_distances(const mat &d2) const {
+    throw logic_error("The kernel can not be evaluated from distances");
+  }
+
+  mat kernel_class::derivate_distances(size_t param_id, const mat &d2) const {
+    throw logic_error("The kernel can not be evaluated from distances");
+  }
+
+  vector<double> kernel_class::contract_distances(const mat &W, const mat &d2,
+      size_t n_threads) const {
+    throw logic_error("The kernel can not be evaluated from distances");
+  }
+
+  shared_ptr<kernel_class> kernel_class::clone() const {
+    throw logic_error("clone not implemented");
+  }
+
   namespace kernels {
     struct squared_exponential::implementation {
       vector<double> params;
@@ -197,6 +243,120 @@ namespace gplib {
         return ans;
 
       }
+
+      vector<double> contract(const mat &W, const mat &X, const mat &Y,
+        bool diag = false, size_t n_threads = 0) {
+        double sigma  = params[0];
+        double lambda = params[1];
+        double l2 = lambda * lambda;
+        // sum W * exp(-d2 / 2l^2) and sum W * exp(-d2 / 2l^2) * d2
+        double w_e = 0, w_e_d2 = 0;
+        if (diag) {
+          for (size_t i = 0; i < X.n_rows; ++i) {
+            double d2 = accu(square(X.row(i) - Y.row(i)));
+            double e = exp(d2 / (-2.0 * l2));
+            w_e += W(i) * e;
+            w_e_d2 += W(i) * e * d2;
+          }
+        } else if (X.n_rows > 0 && Y.n_rows > 0) {
+          const size_t tile = 256;
+          size_t n_tiles = (X.n_rows + tile - 1) / tile;
+          rowvec y_norms = sum(square(Y), 1).t();
+          // Partial sums per tile, added in tile order afterwards
+          vec t_e(n_tiles), t_e_d2(n_tiles);
+          parallel_for(0, n_tiles, [&](size_t t) {
+            size_t first = t * tile;
+            size_t last = min(first + tile, (size_t) X.n_rows) - 1;
+            mat d2 = -2.0 * X.rows(first, last) * Y.t();
+            d2.each_col() += sum(square(X.rows(first, last)), 1);
+            d2.each_row() += y_norms;
+            d2.elem(find(d2 < 0)).zeros();
+            mat we = W.rows(first, last) % exp(d2 / (-2.0 * l2));
+            t_e(t) = accu(we);
+            t_e_d2(t) = accu(we % d2);
+          }, n_threads);
+          for (size_t t = 0; t < n_tiles; ++t) {
+            w_e += t_e(t);
+            w_e_d2 += t_e_d2(t);
+          }
+        }
+
+        vector<double> ans(params.size(), 0.0);
+        ans[0] = 2.0 * sigma * w_e;
+        ans[1] = sigma * sigma * w_e_d2 / (l2 * lambda);
+        // The noise term is sig_noise ^ 2 * eye(X.n_rows, Y.n_rows)
+        ans[2] = 2.0 * params[2] * (diag ? accu(W) : accu(W.diag()));
+        return ans;
+      }
+
+      mat eval_distances(const mat &d2) {
+        double sigma = params[0];
+        double lambda = params[1];
+        return sigma * sigma * exp(d2 / (-2.0 * (lambda * lambda))) +
+          params[2] * params[2] * eye(d2.n_rows, d2.n_cols);
+      }
+
+      mat derivate_distances(size_t param_id, const mat &d2) {
+        double sigma = params[0];
+        double lambda = params[1];
+        if (param_id == 0)
+          return 2.0 * sigma * exp(d2 * -0.5 / (lambda * lambda));
+        if (param_id == 1)
+          return sigma * sigma * exp(d2 / (-2.0 * (lambda * lambda))) % d2 /
+            (lambda * lambda * lambda);
+        if (param_id == 2)
+          return 2.0 * params[2] * eye(d2.n_rows, d2.n_cols);
+        throw logic_error("Input derivatives need the inputs");
+      }
+
+      vector<double> contract_distances(const mat &W, const mat &d2,
+        size_t n_threads = 0) {
+        double sigma  = params[0];
+        double lambda = params[1];
+        double l2 = lambda * lambda;
+        // Same sums as contract, in tiles of columns
+        const size_t tile = 256;
+        size_t n_tiles = (d2.n_cols + tile - 1) / tile;
+        vec t_e(n_tiles), t_e_d2(n_tiles);
+        parallel_for(0, n_tiles, [&](size_t t) {
+          size_t first = t * tile;
+          size_t last = min(first + tile, (size_t) d2.n_cols) - 1;
+          mat we = W.cols(first, last) % exp(d2.cols(first, last) / (-2.0 * l2));
+          t_e(t) = accu(we);
+          t_e_d2(t) = accu(we % d2.cols(first, last));
+        }, n_threads);
+        double w_e = 0, w_e_d2 = 0;
+        for (size_t t = 0; t < n_tiles; ++t) {
+          w_e += t_e(t);
+          w_e_d2 += t_e_d2(t);
+        }
+
+        vector<double> ans(params.size(), 0.0);
+        ans[0] = 2.0 * sigma * w_e;
+        ans[1] = sigma * sigma * w_e_d2 / (l2 * lambda);
+        ans[2] = 2.0 * params[2] * accu(W.diag());
+        return ans;
+      }
+
+      cube derivate_wrt_inputs(const mat &X, const mat &Z) {
+        // dK(x, z) / dz_c = K(x, z) * (x_c - z_c) / l^2, without the noise
+        double sigma = params[0];
+        double l2 = params[1] * params[1];
+        cube ans(X.n_rows, Z.n_rows, Z.n_cols);
+        if (X.n_rows == 0 || Z.n_rows == 0)
+          return ans;
+        mat d2 = -2.0 * X * Z.t();
+        d2.each_col() += sum(square(X), 1);
+        d2.each_row() += sum(square(Z), 1).t();
+        d2.elem(find(d2 < 0)).zeros();
+        mat k = sigma * sigma * exp(d2 / (-2.0 * l2)) / l2;
+        for (size_t c = 0; c < Z.n_cols; ++c) {
+          mat diff = repmat(X.col(c), 1, Z.n_rows);
+          diff.each_row() -= Z.col(c).t();
+          ans.slice(c) = k % diff;
+        }
+        return ans;
+      }
     }; // End of implementation.
 
     squared_exponential::squared_exponential() {
@@ -223,6 +383,34 @@ namespace gplib {
       return pimpl-> derivative(param_id, X, Y, diag);
     }
 
+    vector<double> squared_exponential::contract(const mat &W, const mat &X,
+        const mat &Y, bool diag, size_t n_threads) const {
+      return pimpl-> contract(W, X, Y, diag, n_threads);
+    }
+
+    cube squared_exponential::derivate_wrt_inputs(const mat &X,
+        const mat &Z) const {
+      return pimpl-> derivate_wrt_inputs(X, Z);
+    }
+
+    bool squared_exponential::isotropic() const {
+      return true;
+    }
+
+    mat squared_exponential::eval_distances(const mat &d2) const {
+      return pimpl-> eval_distances(d2);
+    }
+
+    mat squared_exponential::derivate_distances(size_t param_id,
+        const mat &d2) const {
+      return pimpl-> derivate_distances(param_id, d2);
+    }
+
+    vector<double> squared_exponential::contract_distances(const mat &W,
+        const mat &d2, size_t n_threads) const {
+      return pimpl-> contract_distances(W, d2, n_threads);
+    }
+
     size_t squared_exponential::n_params() const {
       return pimpl-> params.size();
     }
@@ -249,5 +437,11 @@ namespace gplib {
     vector<double> squared_exponential::get_upper_bounds() const {
         return pimpl-> upper_bounds;
     }
+
+    shared_ptr<kernel_class> squared_exponential::clone() const {
+      auto ans = make_shared<squared_exponential>();
+      *ans-> pimpl = *pimpl;
+      return ans;
+    }
   };
 };
@@ -66,6 +66,38 @@ namespace gplib {
          **/
         arma::mat derivate(size_t param_id, const arma::mat &X,
           const arma::mat &Y, bool diag = false) const;
+        /**
+         *  Returns sum_ij W(i, j) * dK(i, j) / dT_d for sig, l and sig_noise.
+         *  The inputs are swept in tiles of rows, so memory is bounded by the
+         *  tile size times Y.n_rows.
+         **/
+        std::vector<double> contract(const arma::mat &W, const arma::mat &X,
+          const arma::mat &Y, bool diag = false, size_t n_threads = 0) const;
+        /**
+         *  Returns the derivatives wrt the inputs Z in compact form, see
+         *  kernel_class::derivate_wrt_inputs, in a single pass over X and Z.
+         **/
+        arma::cube derivate_wrt_inputs(const arma::mat &X,
+          const arma::mat &Z) const;
+        /**
+         *  The kernel only depends on |x - y|^2, returns true.
+         **/
+        bool isotropic() const;
+        /**
+         *  Evaluates sig^2 * exp(-d2 / 2l^2) plus the noise term, see
+         *  kernel_class::eval_distances.
+         **/
+        arma::mat eval_distances(const arma::mat &d2) const;
+        /**
+         *  Derivative wrt sig, l or sig_noise from the squared distances.
+         **/
+        arma::mat derivate_distances(size_t param_id,
+          const arma::mat &d2) const;
+        /**
+         *  Same sums as contract from the squared distances.
+         **/
+        std::vector<double> contract_distances(const arma::mat &W,
+          const arma::mat &d2, size_t n_threads = 0) const;
         /**
          *  Returns the number of params needed by the kernel.
          **/
@@ -101,6 +133,10 @@ namespace gplib {
          *  of the parameters of the kernel.
          **/
         std::vector<double> get_upper_bounds() const;
+        /**
+         *  Returns a copy with its own parameters and bounds.
+         **/
+        std::shared_ptr<kernel_class> clone() const;
     };
   }
 }
@@ -5,14 +5,141 @@ using namespace arma;
 using namespace std;
 
 namespace gplib{
+  void block_derivative::add(size_t row, size_t col, const mat &block) {
+    first_row.push_back(row);
+    first_col.push_back(col);
+    blocks.push_back(block);
+  }
+
+  mat block_derivative::dense() const {
+    mat ans = zeros<mat>(n_rows, n_cols);
+    for (size_t k = 0; k < blocks.size(); ++k)
+      if (blocks[k].n_elem > 0)
+        ans.submat(first_row[k], first_col[k],
+            first_row[k] + blocks[k].n_rows - 1,
+            first_col[k] + blocks[k].n_cols - 1) += blocks[k];
+    return ans;
+  }
+
+  double block_derivative::contract(const mat &W, bool diag) const {
+    double ans = 0;
+    for (size_t k = 0; k < blocks.size(); ++k) {
+      const mat &b = blocks[k];
+      if (b.n_elem == 0)
+        continue;
+      if (!diag) {
+        ans += accu(W.submat(first_row[k], first_col[k],
+              first_row[k] + b.n_rows - 1, first_col[k] + b.n_cols - 1) % b);
+        continue;
+      }
+      // Entries of the block on the diagonal of the full matrix
+      for (size_t a = 0; a < b.n_rows; ++a) {
+        size_t r = first_row[k] + a;
+        if (r >= first_col[k] && r < first_col[k] + b.n_cols)
+          ans += W(r) * b(a, r - first_col[k]);
+      }
+    }
+    return ans;
+  }
+
+  block_derivative multioutput_kernel_class::derivate_blocks(size_t param_id,
+      const vector<mat> &X, const vector<mat> &Y, bool diag) const {
+    block_derivative ans;
+    mat D = derivate(param_id, X, Y, diag);
+    ans.n_rows = D.n_rows;
+    ans.n_cols = D.n_cols;
+    ans.add(0, 0, D);
+    return ans;
+  }
+
+  vector<double> multioutput_kernel_class::contract(const mat &W,
+      const vector<mat> &X, const vector<mat> &Y, bool diag,
+      size_t n_threads) const {
+    // Each parameter writes its own slot
+    vector<double> ans(n_params());
+    parallel_for(0, ans.size(), [&](size_t d) {
+      ans[d] = derivate_blocks(d, X, Y, diag).contract(W, diag);
+    }, n_threads);
+    return ans;
+  }
+
+  shared_ptr<multioutput_kernel_class> multioutput_kernel_class::clone() const {
+    throw logic_error("clone not implemented");
+  }
+
+  cube multioutput_kernel_class::derivate_wrt_inputs(const vector<mat> &X,
+      const vector<mat> &Z) const {
+    size_t n_rows = 0, n_cols = 0, dim = 0;
+    for (size_t i = 0; i < X.size(); ++i)
+      n_rows += X[i].n_rows;
+    for (size_t j = 0; j < Z.size(); ++j) {
+      n_cols += Z[j].n_rows;
+      if (Z[j].n_rows > 0)
+        dim = Z[j].n_cols;
+    }
+
+    cube ans(n_rows, n_cols, dim, fill::zeros);
+    size_t param_id = n_params(), first_col = 0;
+    for (size_t j = 0; j < Z.size(); ++j) {
+      for (size_t m = 0; m < Z[j].n_rows; ++m)
+        for (size_t c = 0; c < Z[j].n_cols; ++c)
+          ans.slice(c).col(first_col + m) = derivate(param_id +
+              m * Z[j].n_cols + c, X, Z).col(first_col + m);
+      param_id += Z[j].size();
+      first_col += Z[j].n_rows;
+    }
+    return ans;
+  }
+
+  namespace {
+    // d2(i, j) = |X.row(i) - Y.row(j)|^2, summed over the columns in the
+    // same order as the kernels do it.
+    mat squared_distances(const mat &X, const mat &Y) {
+      mat d2 = zeros<mat>(X.n_rows, Y.n_rows);
+      for (size_t c = 0; c < X.n_cols; ++c) {
+        mat diff = repmat(X.col(c), 1, Y.n_rows);
+        diff.each_row() -= Y.col(c).t();
+        d2 += square(diff);
+      }
+      return d2;
+    }
+
+    // True if both sets hold the same inputs, then eval(X, Y) is symmetric.
+    // O(N * D), negligible next to the covariance blocks.
+    bool same_inputs(const vector<mat> &X, const vector<mat> &Y) {
+      if (&X == &Y)
+        return true;
+      if (X.size() != Y.size())
+        return false;
+      for (size_t i = 0; i < X.size(); ++i)
+        if (X[i].n_rows != Y[i].n_rows || X[i].n_cols != Y[i].n_cols ||
+            !equal(X[i].begin(), X[i].end(), Y[i].begin()))
+          return false;
+      return true;
+    }
+  };
+
   namespace multioutput_kernels{
     struct lmc_kernel::implementation{
       vector<mat> B;
       vector<mat> A; // A * A.t() = B, where A is lower triangular.
+      // With rank > 0, B = A * A.t() + diagmat(kappa) and A is D x rank.
+      size_t rank = 0;
+      vector<vec> kappa;
       vector<shared_ptr<kernel_class>> kernels;
       vector<double> lower_bounds;
       vector<double> upper_bounds;
 
+      // K_q(X, Y), isotropic kernels use the squared distances of the block,
+      // which the caller keeps while it loops over the latent functions.
+      mat inner_eval(size_t q, const mat &X, const mat &Y, mat &d2) {
+        if (!kernels[q]-> isotropic())
+          return kernels[q]-> eval(X, Y);
+        if (d2.is_empty())
+          d2 = squared_distances(X, Y);
+        return kernels[q]-> eval_distances(d2);
+      }
+
       void default_constructor(size_t lf_number, size_t n_outputs) {
         vector<double> kernel_params(3, 0.1);
         kernels.clear();
@@ -23,9 +150,50 @@ namespace gplib{
 
         A = vector<mat>(kernels.size(), eye<mat>(n_outputs, n_outputs));
         B = vector<mat>(kernels.size(), eye<mat>(n_outputs, n_outputs));
+        kappa = vector<vec>(kernels.size());
+      }
+
+      // Number of parameters of the parameter matrix q
+      size_t coreg_params(size_t q) {
+        if (rank == 0)
+          return B[q].size();
+        return B[q].n_rows * (rank + 1);
+      }
+
+      // Low-rank form closest to B[q]: the leading eigenpairs go to A and
+      // what is left of the diagonal to kappa.
+      void project_low_rank(size_t q) {
+        size_t n = B[q].n_rows;
+        A[q] = zeros<mat>(n, rank);
+        kappa[q] = zeros<vec>(n);
+        if (n == 0)
+          return;
+        vec l;
+        mat U;
+        eig_sym(l, U, force_symmetric(B[q]));
+        for (size_t c = 0; c < rank && c < n; ++c)
+          A[q].col(c) = U.col(n - 1 - c) * sqrt(max(l(n - 1 - c), 0.0));
+        kappa[q] = clamp(vec(B[q].diag() - sum(square(A[q]), 1)), 0.0,
+            datum::inf);
+        B[q] = A[q] * A[q].t() + diagmat(kappa[q]);
       }
 
-      mat eval(const vector<mat> &X, const vector<mat> &Y, bool diag = false) {
+      // Derivative of B[q](i, j) wrt the low-rank parameter p, the entries
+      // of A[q] in row major order followed by kappa[q].
+      double low_rank_coefficient(size_t q, size_t p, size_t i, size_t j) {
+        if (p >= A[q].size())
+          return (i == j && i == p - A[q].size()) ? 1.0 : 0.0;
+        size_t a = p / rank, r = p % rank;
+        double ans = 0;
+        if (i == a)
+          ans += A[q](j, r);
+        if (j == a)
+          ans += A[q](i, r);
+        return ans;
+      }
+
+      mat eval(const vector<mat> &X, const vector<mat> &Y, bool diag = false,
+          size_t n_threads = 0) {
         size_t total_rows = 0, total_cols = 0;
         for (size_t i = 0; i < X.size(); ++i) {
           total_rows += X[i].n_rows;
@@ -40,6 +208,11 @@ namespace gplib{
           cov = zeros<mat>(total_rows, total_cols);
           size_t first_row = 0, first_col = 0;
           for (size_t i = 0; i < X.size(); i++) {
+            if (X[i].n_rows == 0 || Y[i].n_rows == 0) { // Empty class
+              first_col += Y[i].n_rows;
+              first_row += X[i].n_rows;
+              continue;
+            }
             mat cov_ab = zeros<mat> (X[i].n_rows, Y[i].n_rows);
             for (size_t k = 0; k < B.size(); k++) {
               cov_ab += B[k](i, i) * (kernels[k]-> eval(X[i], Y[i], diag));
@@ -51,23 +224,40 @@ namespace gplib{
           }
           cov = cov;
         } else {
-          cov.resize(total_rows, total_cols);
-          size_t first_row = 0, first_col = 0;
-          for (size_t i = 0; i < X.size(); i++) {
-            for (size_t j = 0; j < Y.size(); j++) {
-              mat cov_ab = zeros<mat> (X[i].n_rows, Y[j].n_rows);
-              for (size_t k = 0; k < B.size(); k++) {
-                cov_ab += B[k](i, j) * (kernels[k]-> eval(X[i], Y[j]));
-              }
-
-              cov.submat (first_row, first_col, first_row + X[i].n_rows - 1,
-                  first_col + Y[j].n_rows - 1) = cov_ab;
-
-              first_col += Y[j].n_rows;
+          cov.set_size(total_rows, total_cols);
+          vector<size_t> first_row(X.size() + 1, 0), first_col(Y.size() + 1, 0);
+          for (size_t i = 0; i < X.size(); ++i)
+            first_row[i + 1] = first_row[i] + X[i].n_rows;
+          for (size_t j = 0; j < Y.size(); ++j)
+            first_col[j + 1] = first_col[j] + Y[j].n_rows;
+
+          // With equal inputs the block (j, i) is the transpose of (i, j),
+          // only i <= j is evaluated. The blocks are independent and each one
+          // is written in place by its own task.
+          bool symmetric = same_inputs(X, Y);
+          vector<pair<size_t, size_t>> blocks;
+          for (size_t i = 0; i < X.size(); i++)
+            for (size_t j = symmetric ? i : 0; j < Y.size(); j++)
+              if (X[i].n_rows > 0 && Y[j].n_rows > 0) // Skip empty classes
+                blocks.push_back(make_pair(i, j));
+
+          parallel_for(0, blocks.size(), [&](size_t b) {
+            size_t i = blocks[b].first, j = blocks[b].second;
+            arma::span rows(first_row[i], first_row[i + 1] - 1);
+            arma::span cols(first_col[j], first_col[j + 1] - 1);
+            if (B.empty())
+              cov(rows, cols).zeros();
+            mat d2;
+            for (size_t k = 0; k < B.size(); k++) {
+              if (k == 0)
+                cov(rows, cols) = B[k](i, j) * inner_eval(k, X[i], Y[j], d2);
+              else
+                cov(rows, cols) += B[k](i, j) * inner_eval(k, X[i], Y[j], d2);
             }
-            first_row += X[i].n_rows;
-            first_col = 0;
-          }
+            // Same offsets for X and Y, the mirrored block swaps the spans
+            if (symmetric && i != j)
+              cov(cols, rows) = cov(rows, cols).t();
+          }, n_threads);
         }
         return cov;
       }
@@ -191,123 +381,244 @@ namespace gplib{
 
       }
 
-      mat derivative_wrt_B(size_t q, size_t param_id, const vector<mat> &X,
-        const vector<mat> &Y, size_t ans_rows, size_t ans_cols,
-        bool diag = false) {
+      // The derivative wrt a parameter matrix entry only has blocks in the
+      // row and column bands of the outputs it touches (a single block in
+      // the lower triangular form), and the one wrt an inner kernel
+      // parameter has the blocks of the non-empty classes. Only the
+      // pseudo-inputs are returned as a dense block.
+      block_derivative derivate_blocks(size_t param_id, const vector<mat> &X,
+        const vector<mat> &Y, bool diag) {
+        vector<size_t> first_row(X.size() + 1, 0), first_col(Y.size() + 1, 0);
+        for (size_t i = 0; i < X.size(); ++i)
+          first_row[i + 1] = first_row[i] + X[i].n_rows;
+        for (size_t j = 0; j < Y.size(); ++j)
+          first_col[j + 1] = first_col[j] + Y[j].n_rows;
+
+        block_derivative ans;
+        ans.n_rows = first_row.back();
+        ans.n_cols = first_col.back();
+        auto visit = [&](const function<void(size_t, size_t)> &f) {
+          for (size_t i = 0; i < X.size(); ++i)
+            for (size_t j = 0; j < Y.size(); ++j)
+              if (!(diag && i != j) && X[i].n_rows > 0 && Y[j].n_rows > 0)
+                f(i, j);
+        };
 
-        mat ans = zeros<mat>(ans_rows, ans_cols);
-        size_t id_out_1 = param_id / B[q].n_rows;
-        size_t id_out_2 = param_id % B[q].n_rows;
-        size_t first_row = 0, first_col = 0;
-        if (diag) {
-          for (size_t i = 0; i < X.size(); i++) {
-            mat ans_ab = zeros<mat> (X[i].n_rows, Y[i].n_rows);
-            if (i == id_out_1) {
-              ans_ab = A[q](id_out_1, id_out_2) *
-                       (kernels[q]-> eval(X[i], Y[i], diag));
-            }
-            if (i * X.size() + i == param_id) {
-              ans.submat (first_row, first_col, first_row + X[i].n_rows - 1,
-                  first_col + Y[i].n_rows - 1) = ans_ab;
-            }
-            first_col += Y[i].n_rows;
-            first_row += X[i].n_rows;
-          }
-        } else {
-          for (size_t i = 0; i < X.size(); i++) {
-            for (size_t j = 0; j < Y.size(); j++) {
-              mat ans_ab = zeros<mat> (X[i].n_rows, Y[j].n_rows);
-              if (i == id_out_1 && j == id_out_1) {
-                ans_ab = A[q](id_out_1, id_out_2) *
-                         (kernels[q]-> eval(X[i], Y[j]));
-              }
-              else if (j == id_out_1) {
-                ans_ab = A[q](i, id_out_2) * (kernels[q]-> eval(X[i], Y[j]));
-              } else if (i == id_out_1) {
-                ans_ab = A[q](j, id_out_2) * (kernels[q]-> eval(X[i], Y[j]));
-              }
-              if (i * X.size() + j == param_id) {
-                ans.submat (first_row, first_col, first_row + X[i].n_rows - 1,
-                    first_col + Y[j].n_rows - 1) = ans_ab;
-              }
-              first_col += Y[j].n_rows;
-            }
-            first_row += X[i].n_rows;
-            first_col = 0;
+        for (size_t q = 0; q < B.size(); ++q) { // current latent fuction.
+          if (param_id < coreg_params(q)) {
+            visit([&](size_t i, size_t j) {
+              double coef = rank > 0 ? low_rank_coefficient(q, param_id, i, j) :
+                B_coefficient(q, param_id, i, j, X.size(), diag);
+              if (coef != 0)
+                ans.add(first_row[i], first_col[j],
+                    coef * kernels[q]-> eval(X[i], Y[j], diag));
+            });
+            return ans;
           }
+          param_id -= coreg_params(q);
         }
-        return ans;
-      }
 
-      mat derivative_wrt_kernels(size_t q, size_t param_id, const vector<mat>
-        &X, const vector<mat> &Y, size_t ans_rows, size_t ans_cols,
-        bool diag = false) {
-        mat ans = zeros<mat>(ans_rows, ans_cols);
-        size_t first_row = 0, first_col = 0;
-        if (diag) {
-          for (size_t i = 0; i < X.size(); i++) {
-            mat ans_ab = B[q](i, i) *
-              kernels[q]-> derivate(param_id, X[i], Y[i], diag);
-            ans.submat (first_row, first_col, first_row + X[i].n_rows - 1,
-                first_col + Y[i].n_rows - 1) = ans_ab;
-            first_row += X[i].n_rows;
-            first_col += Y[i].n_rows;
-          }
-        } else {
-          for (size_t i = 0; i < X.size(); i++) {
-            for (size_t j = 0; j < Y.size(); j++) {
-              if ((diag && i == j) || !diag) {
-                mat ans_ab = B[q](i, j) *
-                  kernels[q]-> derivate(param_id, X[i], Y[j], diag);
-                ans.submat (first_row, first_col, first_row + X[i].n_rows - 1,
-                    first_col + Y[j].n_rows - 1) = ans_ab;
-              }
-              first_col += Y[j].n_rows;
-            }
-            first_row += X[i].n_rows;
-            first_col = 0;
+        // from here they must be params of each little kernel.
+        for (size_t q = 0; q < kernels.size(); ++q) {
+          if (param_id < kernels[q]-> n_params()) {
+            visit([&](size_t i, size_t j) {
+              ans.add(first_row[i], first_col[j], B[q](i, j) *
+                  kernels[q]-> derivate(param_id, X[i], Y[j], diag));
+            });
+            return ans;
           }
+          param_id -= kernels[q]-> n_params();
         }
+
+        ans.add(0, 0, derivate_wrt_data_an(param_id, X, Y, ans.n_rows,
+              ans.n_cols, diag));
         return ans;
       }
 
       mat derivate(size_t param_id, const vector<mat> &X, const vector<mat> &Y,
         bool diag) {
+        return derivate_blocks(param_id, X, Y, diag).dense();
+      }
 
-        size_t tot_rows = 0, tot_cols = 0;
-        for (size_t i = 0; i < X.size(); ++i)
-          tot_rows += X[i].n_rows;
+      // Coefficient of K_q(X[i], Y[j]) in the block (i, j) of the derivative
+      // wrt the entry param_id of the lower triangular parameter matrix q,
+      // only the block i * n_blocks + j == param_id is non-zero.
+      double B_coefficient(size_t q, size_t param_id, size_t i, size_t j,
+        size_t n_blocks, bool diag) {
+        size_t id_out_1 = param_id / B[q].n_rows;
+        size_t id_out_2 = param_id % B[q].n_rows;
+        if (i * n_blocks + j != param_id)
+          return 0;
+        if (diag)
+          return i == id_out_1 ? A[q](id_out_1, id_out_2) : 0;
+        if (i == id_out_1 && j == id_out_1)
+          return A[q](id_out_1, id_out_2);
+        if (j == id_out_1)
+          return A[q](i, id_out_2);
+        if (i == id_out_1)
+          return A[q](j, id_out_2);
+        return 0;
+      }
 
-        for (size_t i = 0; i < Y.size(); ++i)
-          tot_cols += Y[i].n_rows;
+      // Gradient of the parameters of B[q] from
+      // G(i, j) = accu(W_ij % K_q(X[i], Y[j])), only its diagonal with diag.
+      vector<double> coreg_gradient(size_t q, const mat &G, bool diag) {
+        size_t n = B[q].n_rows;
+        vector<double> ans(coreg_params(q), 0.0);
+        if (rank == 0) {
+          for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+              if (!(diag && i != j))
+                ans[i * n + j] = B_coefficient(q, i * n + j, i, j, n, diag) *
+                  G(i, j);
+          return ans;
+        }
 
-        for (size_t q = 0; q < B.size(); ++q) { // current latent fuction.
-          if (param_id < B[q].size())
-            return derivative_wrt_B(q, param_id, X, Y, tot_rows, tot_cols,
-            diag);
-          param_id -= B[q].size();
+        // dB = dA * A' + A * dA' + diagmat(dkappa)
+        mat Gs = diag ? mat(diagmat(G)) : G;
+        mat gA = (Gs + Gs.t()) * A[q];
+        size_t p = 0;
+        for (size_t a = 0; a < gA.n_rows; ++a)
+          for (size_t r = 0; r < gA.n_cols; ++r)
+            ans[p++] = gA(a, r);
+        for (size_t a = 0; a < n; ++a)
+          ans[p++] = Gs(a, a);
+        return ans;
+      }
+
+      vector<double> contract(const mat &W, const vector<mat> &X,
+        const vector<mat> &Y, bool diag = false, size_t n_threads = 0) {
+        vector<size_t> first_row(X.size() + 1, 0), first_col(Y.size() + 1, 0);
+        for (size_t i = 0; i < X.size(); ++i)
+          first_row[i + 1] = first_row[i] + X[i].n_rows;
+        for (size_t j = 0; j < Y.size(); ++j)
+          first_col[j + 1] = first_col[j] + Y[j].n_rows;
+
+        vector<size_t> B_offset(B.size(), 0), kernel_offset(B.size(), 0);
+        size_t total = 0;
+        for (size_t q = 0; q < B.size(); ++q) {
+          B_offset[q] = total;
+          total += coreg_params(q);
+        }
+        for (size_t q = 0; q < B.size(); ++q) {
+          kernel_offset[q] = total;
+          total += kernels[q]-> n_params();
         }
 
-        // from here they must be params of each little kernel.
-        for (size_t q = 0; q < kernels.size(); ++q) {
-          if (param_id < kernels[q]-> n_params())
-            return derivative_wrt_kernels(q, param_id, X, Y, tot_rows, tot_cols,
-            diag);
-            //  ans must be equal to
-            //  kron(B[q], kernels[q]-> derivate(param_id, X, Y));
-          param_id -= kernels[q]-> n_params();
+        // Blocks (q, i, j) are independent, each one keeps its partial
+        // results and they are added in this order afterwards.
+        struct block {
+          size_t q, i, j;
+          double b;            // accu(W_ij % K_q), see coreg_gradient
+          vector<double> g;    // Inner kernel terms, already scaled
+        };
+        vector<pair<size_t, size_t>> pairs;
+        for (size_t i = 0; i < X.size(); ++i)
+          for (size_t j = 0; j < Y.size(); ++j)
+            if (!(diag && i != j) && X[i].n_rows > 0 && Y[j].n_rows > 0)
+              pairs.push_back(make_pair(i, j));
+        vector<block> blocks;
+        for (size_t q = 0; q < B.size(); ++q)
+          for (size_t p = 0; p < pairs.size(); ++p)
+            blocks.push_back({q, pairs[p].first, pairs[p].second, 0.0,
+                vector<double>()});
+
+        // One task per pair (i, j), the squared distances of the block only
+        // live while its latent functions are contracted. Small pair counts
+        // leave the threads to the inner kernel.
+        size_t inner_threads = pairs.size() == 1 ? n_threads : 1;
+        parallel_for(0, pairs.size(), [&](size_t p) {
+          size_t i = pairs[p].first, j = pairs[p].second;
+          mat W_ij = diag ? mat(W.rows(first_row[i], first_row[i + 1] - 1)) :
+            mat(W.submat(first_row[i], first_col[j],
+                first_row[i + 1] - 1, first_col[j + 1] - 1));
+          mat d2;
+          for (size_t q = 0; q < B.size(); ++q) {
+            block &bl = blocks[q * pairs.size() + p];
+
+            // Parameter matrix, mapped to its parameters by coreg_gradient,
+            // and inner kernel, the block is B[q](i, j) * K_q(X[i], Y[j])
+            if (diag) {
+              bl.b = dot(W_ij, kernels[q]-> eval(X[i], Y[j], true).diag());
+              bl.g = kernels[q]-> contract(W_ij, X[i], Y[j], true,
+                  inner_threads);
+            } else if (kernels[q]-> isotropic()) {
+              bl.b = accu(W_ij % inner_eval(q, X[i], Y[j], d2));
+              bl.g = kernels[q]-> contract_distances(W_ij, d2, inner_threads);
+            } else {
+              bl.b = accu(W_ij % kernels[q]-> eval(X[i], Y[j]));
+              bl.g = kernels[q]-> contract(W_ij, X[i], Y[j], false,
+                  inner_threads);
+            }
+            for (size_t k = 0; k < bl.g.size(); ++k)
+              bl.g[k] *= B[q](i, j);
+          }
+        }, n_threads);
+
+        vector<double> ans(total, 0.0);
+        vector<mat> G(B.size());
+        for (size_t q = 0; q < B.size(); ++q)
+          G[q] = zeros<mat>(B[q].n_rows, B[q].n_cols);
+        for (size_t k = 0; k < blocks.size(); ++k) {
+          const block &bl = blocks[k];
+          G[bl.q](bl.i, bl.j) += bl.b;
+          for (size_t p = 0; p < bl.g.size(); ++p)
+            ans[kernel_offset[bl.q] + p] += bl.g[p];
         }
+        for (size_t q = 0; q < B.size(); ++q) {
+          vector<double> g = coreg_gradient(q, G[q], diag);
+          copy(g.begin(), g.end(), ans.begin() + B_offset[q]);
+        }
+        return ans;
+      }
 
-        return derivate_wrt_data_an(param_id, X, Y, tot_rows, tot_cols, diag);
+      // Same sums as contract with every block at the same inputs: the
+      // parameter matrix entry (i, j) only sees the block (i, j) and the
+      // inner kernel sees sum_ij B(i, j) * W_ij.
+      vector<double> contract_icm(const mat &G_B, const mat &W_K, const mat &X,
+        size_t n_threads) {
+        if (B.size() != 1)
+          throw logic_error("Intrinsic coregionalization needs one latent function");
+        vector<double> ans = coreg_gradient(0, G_B, false);
+        vector<double> g = kernels[0]-> contract(W_K, X, X, false, n_threads);
+        ans.insert(ans.end(), g.begin(), g.end());
+        return ans;
       }
 
+      cube derivate_wrt_inputs(const vector<mat> &X, const vector<mat> &Z) {
+        vector<size_t> first_row(X.size() + 1, 0), first_col(Z.size() + 1, 0);
+        size_t dim = 0;
+        for (size_t i = 0; i < X.size(); ++i)
+          first_row[i + 1] = first_row[i] + X[i].n_rows;
+        for (size_t j = 0; j < Z.size(); ++j) {
+          first_col[j + 1] = first_col[j] + Z[j].n_rows;
+          if (Z[j].n_rows > 0)
+            dim = Z[j].n_cols;
+        }
+
+        cube ans(first_row.back(), first_col.back(), dim, fill::zeros);
+        for (size_t i = 0; i < X.size(); ++i) {
+          for (size_t j = 0; j < Z.size(); ++j) {
+            if (X[i].n_rows == 0 || Z[j].n_rows == 0)
+              continue;
+            // Block (i, j) is sum_q B[q](i, j) * K_q(X[i], Z[j])
+            for (size_t q = 0; q < B.size(); ++q)
+              ans.subcube(first_row[i], first_col[j], 0,
+                  first_row[i + 1] - 1, first_col[j + 1] - 1, dim - 1) +=
+                B[q](i, j) * kernels[q]-> derivate_wrt_inputs(X[i], Z[j]);
+          }
+        }
+        return ans;
+      }
 
       vector<double> get_params() {
         //set total size of vector
         if (A.size() <= 0 || A[0].size() <= 0)
           return vector<double> ();
 
-        size_t t_size = A.size() * A[0].size();
+        size_t t_size = 0;
+        for (size_t q = 0; q < A.size(); ++q)
+          t_size += coreg_params(q);
         for (size_t k = 0; k < kernels.size(); ++k)
           t_size += kernels[k]->  n_params();
 
@@ -320,6 +631,9 @@ namespace gplib{
               iter++;
             }
           }
+          if (rank > 0)
+            for (size_t i = 0; i < kappa[q].n_elem; ++i)
+              ans[iter++] = kappa[q](i);
         }
 
         vector<double> tmp;
@@ -334,11 +648,12 @@ namespace gplib{
       void set_params(const vector<double> &params, size_t n_outputs = 0) {
         if (n_outputs <= 0){
           if (A.size() > 0 && A[0].size() > 0)
-            n_outputs = A[0].n_cols;
+            n_outputs = A[0].n_rows;
           else
             throw logic_error("Parameters Uninitialized");
         }
-        size_t t_size = A.size() * n_outputs * n_outputs;
+        size_t n_cols = rank > 0 ? rank : n_outputs;
+        size_t t_size = A.size() * n_outputs * (rank > 0 ? rank + 1 : n_outputs);
         for (size_t k = 0; k < kernels.size(); ++k)
           t_size += kernels[k]-> n_params();
 
@@ -348,17 +663,22 @@ namespace gplib{
         size_t iter = 0;
         for (size_t q = 0; q < A.size(); ++q) {
           if (A[q].size() <= 0)
-            A[q] = mat(n_outputs, n_outputs, fill::zeros);
+            A[q] = mat(n_outputs, n_cols, fill::zeros);
           for (size_t i = 0; i < A[q].n_rows; ++i) {
             for (size_t j = 0; j < A[q].n_cols; ++j) {
               A[q](i, j) = params[iter];
-              if (j > i && fabs(params[iter]) > datum::eps) {
+              if (rank == 0 && j > i && fabs(params[iter]) > datum::eps) {
                 throw logic_error("Params matrix must be lower triangular");
               }
               ++iter;
             }
           }
           B[q] = A[q] * A[q].t();
+          if (rank > 0) {
+            kappa[q] = vec(&params[iter], n_outputs);
+            iter += n_outputs;
+            B[q].diag() += kappa[q];
+          }
           if (!check_symmetric(B[q]))
             cout << "Matrix B is not symmetric :(" << endl;
         }
@@ -375,9 +695,13 @@ namespace gplib{
       void set_params_k(const vector<mat> &params) {
         A.resize(params.size());
         B.resize(params.size());
+        kappa.resize(params.size());
         for (size_t i = 0; i < params.size(); ++i) {
-          A[i] = chol(params[i]);
           B[i] = params[i];
+          if (rank > 0)
+            project_low_rank(i);
+          else
+            A[i] = chol(params[i]);
         }
       }
 
@@ -387,7 +711,10 @@ namespace gplib{
         if (a > B[q].n_rows || b > B[q].n_cols)
           throw out_of_range("Param id out of range");
         B[q](a, b) = param;
-        A[q] = chol(B[q]);
+        if (rank > 0)
+          project_low_rank(q);
+        else
+          A[q] = chol(B[q]);
       }
 
       void set_param(size_t q, size_t param_id, double param) {
@@ -420,7 +747,7 @@ namespace gplib{
       size_t n_params() {
         size_t ans = 0;
         for (size_t i = 0; i < B.size(); ++i)
-          ans += B[i].size();
+          ans += coreg_params(i);
 
         for (size_t i = 0; i < kernels.size(); ++i)
           ans += kernels[i]->n_params();
@@ -429,6 +756,8 @@ namespace gplib{
       }
 
       void check_bounds(const vector<double> &bounds) {
+        if (rank > 0) // No structural zeros in the low-rank form
+          return;
         size_t iter = 0;
         for (size_t q = 0; q < A.size(); ++q) {
           for (size_t i = 0; i < A[q].n_rows; ++i) {
@@ -465,11 +794,14 @@ namespace gplib{
         for (size_t q = 0; q < A.size(); ++q) {
           for (size_t i = 0; i < A[q].n_rows; ++i) {
             for (size_t j = 0; j < A[q].n_cols; ++j) {
-              if (j > i)
+              if (rank == 0 && j > i)
                 lower_bound[iter] = 0.0;
               iter++;
             }
           }
+          if (rank > 0) // kappa is a variance
+            for (size_t i = 0; i < kappa[q].n_elem; ++i, ++iter)
+              lower_bound[iter] = max(l_bound, 0.0);
         }
         lower_bounds = lower_bound;
       }
@@ -477,7 +809,7 @@ namespace gplib{
       void set_upper_bounds(const double &u_bound) {
         vector<double> upper_bound(n_params(), u_bound);
         size_t iter = 0;
-        for (size_t q = 0; q < A.size(); ++q) {
+        for (size_t q = 0; q < A.size() && rank == 0; ++q) {
           for (size_t i = 0; i < A[q].n_rows; ++i) {
             for (size_t j = 0; j < A[q].n_cols; ++j) {
               if (j > i)
@@ -489,7 +821,25 @@ namespace gplib{
         upper_bounds = upper_bound;
       }
 
-
+      void set_rank(size_t r) {
+        rank = r;
+        kappa.resize(B.size());
+        for (size_t q = 0; q < B.size(); ++q) {
+          if (B[q].n_rows == 0)
+            continue;
+          if (rank > 0) {
+            project_low_rank(q);
+          } else {
+            mat R;
+            robust_chol(B[q], R);
+            A[q] = trimatl(R.t());
+            B[q] = A[q] * A[q].t();
+          }
+        }
+        // The parameter vector changes its length
+        lower_bounds.clear();
+        upper_bounds.clear();
+      }
     };
 
     lmc_kernel::lmc_kernel() {
@@ -511,8 +861,8 @@ namespace gplib{
     }
 
     mat lmc_kernel::eval(const vector<mat> &X, const vector<mat> &Y,
-        bool diag) const {
-      return pimpl-> eval(X, Y, diag);
+        bool diag, size_t n_threads) const {
+      return pimpl-> eval(X, Y, diag, n_threads);
     }
 
     mat lmc_kernel::derivate(size_t param_id, const vector<mat> &X,
@@ -520,6 +870,26 @@ namespace gplib{
       return pimpl-> derivate(param_id, X, Y, diag);
     }
 
+    block_derivative lmc_kernel::derivate_blocks(size_t param_id,
+      const vector<mat> &X, const vector<mat> &Y, bool diag) const {
+      return pimpl-> derivate_blocks(param_id, X, Y, diag);
+    }
+
+    vector<double> lmc_kernel::contract(const mat &W, const vector<mat> &X,
+      const vector<mat> &Y, bool diag, size_t n_threads) const {
+      return pimpl-> contract(W, X, Y, diag, n_threads);
+    }
+
+    vector<double> lmc_kernel::contract_icm(const mat &G_B, const mat &W_K,
+      const mat &X, size_t n_threads) const {
+      return pimpl-> contract_icm(G_B, W_K, X, n_threads);
+    }
+
+    cube lmc_kernel::derivate_wrt_inputs(const vector<mat> &X,
+      const vector<mat> &Z) const {
+      return pimpl-> derivate_wrt_inputs(X, Z);
+    }
+
     size_t lmc_kernel::n_params() const {
       return pimpl-> n_params();
     }
@@ -544,6 +914,15 @@ namespace gplib{
       pimpl-> kernels = kernels;
       pimpl-> B.resize (kernels.size());
       pimpl-> A.resize (kernels.size());
+      pimpl-> kappa.resize (kernels.size());
+    }
+
+    void lmc_kernel::set_rank(size_t rank) {
+      pimpl-> set_rank(rank);
+    }
+
+    size_t lmc_kernel::get_rank() const {
+      return pimpl-> rank;
     }
 
     double lmc_kernel::get_param(size_t q, size_t a, size_t b) const {
@@ -590,5 +969,13 @@ namespace gplib{
       return pimpl-> upper_bounds;
     }
 
+    shared_ptr<multioutput_kernel_class> lmc_kernel::clone() const {
+      auto ans = make_shared<lmc_kernel>();
+      *ans-> pimpl = *pimpl;
+      for (size_t q = 0; q < pimpl-> kernels.size(); ++q)
+        ans-> pimpl-> kernels[q] = pimpl-> kernels[q]-> clone();
+      return ans;
+    }
+
   };
 };
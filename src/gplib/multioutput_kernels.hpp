@@ -52,9 +52,12 @@ namespace gplib{
          *                for the entries pertaining to the diagonal of the answer
          *                matrix, this is due to performance reasons while using
          *                FITC.
+         *  @param n_threads : Maximum number of threads for the covariance
+         *                     blocks, 0 means default_threads().
          **/
         arma::mat eval(const std::vector<arma::mat> &X,
-            const std::vector<arma::mat> &Y, bool diag = false) const;
+            const std::vector<arma::mat> &Y, bool diag = false,
+            size_t n_threads = 0) const;
 
         /**
          *  Returns the value of the derivative wrt a certain parameter with a
@@ -71,6 +74,48 @@ namespace gplib{
         arma::mat derivate(size_t param_id, const std::vector<arma::mat> &X,
             const std::vector<arma::mat> &Y, bool diag = false) const;
 
+        /**
+         *  Returns the derivative of derivate as its non-zero blocks. A
+         *  parameter matrix entry gives at most one row and one column band
+         *  of blocks (a single block in the lower triangular form), so no
+         *  dense matrix is needed to contract it.
+         **/
+        block_derivative derivate_blocks(size_t param_id,
+            const std::vector<arma::mat> &X, const std::vector<arma::mat> &Y,
+            bool diag = false) const;
+
+        /**
+         *  Returns sum_ij W(i, j) * dK(i, j) / dT_d for the parameter matrices
+         *  and the inner kernels. Each block of W is contracted once per latent
+         *  function, no derivative matrix is formed.
+         **/
+        std::vector<double> contract(const arma::mat &W,
+            const std::vector<arma::mat> &X, const std::vector<arma::mat> &Y,
+            bool diag = false, size_t n_threads = 0) const;
+
+        /**
+         *  Returns contract(W, {X, ..., X}, {X, ..., X}) for a single latent
+         *  function (intrinsic coregionalization), where the covariance is
+         *  kron(B, K(X, X)). The contraction only depends on two reductions of
+         *  W, so the N * D x N * D matrix is never needed.
+         *  @param G_B : D x D matrix, G_B(i, j) = accu(W_ij % K(X, X)).
+         *  @param W_K : N x N matrix, W_K = sum_ij B(i, j) * W_ij.
+         *  @param X : Inputs shared by all the outputs.
+         *  @param n_threads : Maximum number of threads, 0 means
+         *                     default_threads().
+         **/
+        std::vector<double> contract_icm(const arma::mat &G_B,
+            const arma::mat &W_K, const arma::mat &X,
+            size_t n_threads = 0) const;
+
+        /**
+         *  Returns the derivatives wrt the inputs Z in compact form, see
+         *  multioutput_kernel_class::derivate_wrt_inputs. Each block is built
+         *  from the compact derivatives of the inner kernels.
+         **/
+        arma::cube derivate_wrt_inputs(const std::vector<arma::mat> &X,
+            const std::vector<arma::mat> &Z) const;
+
         /**
          *  Returns the total number of parameters needed by the kernel (parameter
          *  matrices, plus the parameters of each inner kernel).
@@ -115,6 +160,24 @@ namespace gplib{
          **/
         void set_param(size_t q, size_t param_id, const double param);
 
+        /**
+         *  Sets the form of the parameter matrices. With rank 0 (the default)
+         *  each B_q = A_q * A_q' with a full lower triangular D x D A_q. With
+         *  rank R > 0, B_q = W_q * W_q' + diagmat(kappa_q) with a D x R W_q,
+         *  so each latent function has D * R + D parameters (the entries of
+         *  W_q in row major order followed by kappa_q) instead of D * D, and
+         *  the gradients only visit those. The current matrices are kept as
+         *  close as the new form allows. The parameter vector changes its
+         *  length, so the bounds are cleared and have to be set again.
+         *  @param rank : Rank of W_q, 0 for the full lower triangular form.
+         **/
+        void set_rank(size_t rank);
+
+        /**
+         *  Returns the rank of the parameter matrices, see set_rank.
+         **/
+        size_t get_rank() const;
+
         /**
          *  Sets the inner kernels.
          *  @param kernels : Shared pointer containing a vector of kernel_class
@@ -200,6 +263,12 @@ namespace gplib{
          * those of the inner kernels.
          **/
         std::vector<double> get_upper_bounds() const;
+
+        /**
+         * Returns a copy with its own parameter matrices, bounds and copies
+         * of the inner kernels.
+         **/
+        std::shared_ptr<multioutput_kernel_class> clone() const;
     };
 
   }
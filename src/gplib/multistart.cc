@@ -0,0 +1,92 @@
+#include "gplib.hpp"
+
+using namespace arma;
+using namespace std;
+
+namespace gplib {
+
+  mat starting_points(size_t n, const vector<double> &lower_bounds,
+      const vector<double> &upper_bounds, int design, rng_stream &rng) {
+    size_t dim = lower_bounds.size();
+    if (upper_bounds.size() != dim)
+      throw length_error("Bounds have different sizes");
+    for (size_t j = 0; j < dim; ++j) {
+      if (!std::isfinite(lower_bounds[j]) || !std::isfinite(upper_bounds[j]))
+        throw logic_error("Multi-start requires finite bounds");
+      if (lower_bounds[j] > upper_bounds[j])
+        throw logic_error("Lower bound greater than upper bound");
+    }
+
+    mat ans;
+    if (design == LATIN_HYPERCUBE)
+      ans = latin_hypercube(n, dim, rng);
+    else if (design == SOBOL)
+      ans = sobol(n, dim, rng);
+    else
+      throw logic_error("Unknown design");
+
+    for (size_t j = 0; j < dim; ++j)
+      ans.col(j) = lower_bounds[j] +
+        ans.col(j) * (upper_bounds[j] - lower_bounds[j]);
+    return ans;
+  }
+
+  size_t multi_start(const mat &starts, int max_iter, double drop_margin,
+      const function<double(size_t, vector<double> &, int)> &run,
+      vector<double> &x, double &value, size_t n_threads) {
+    size_t K = starts.n_rows;
+    if (K == 0)
+      throw logic_error("No starting points");
+
+    vector<vector<double>> points(K);
+    vector<double> values(K, -HUGE_VAL);
+    vector<bool> active(K, true);
+    vector<exception_ptr> errors(K);
+    for (size_t k = 0; k < K; ++k)
+      points[k] = conv_to<vector<double>>::from(starts.row(k));
+
+    auto round = [&](int evals) {
+      parallel_for(0, K, [&](size_t k) {
+        if (!active[k])
+          return;
+        try {
+          values[k] = run(k, points[k], evals);
+        } catch (const runtime_error &) {
+          errors[k] = current_exception();
+          values[k] = -HUGE_VAL;
+        }
+      }, n_threads);
+      // vector<bool> is not safe to write concurrently, update it here
+      for (size_t k = 0; k < K; ++k)
+        if (errors[k])
+          active[k] = false;
+    };
+
+    int probe = max_iter;
+    if (std::isfinite(drop_margin) && max_iter > 1)
+      probe = max(1, max_iter / 4);
+    round(probe);
+
+    if (probe < max_iter) {
+      double best = -HUGE_VAL;
+      for (size_t k = 0; k < K; ++k)
+        if (active[k])
+          best = max(best, values[k]);
+      for (size_t k = 0; k < K; ++k)
+        if (active[k] && values[k] < best - drop_margin)
+          active[k] = false;
+      round(max_iter - probe);
+    }
+
+    size_t ans = K;
+    for (size_t k = 0; k < K; ++k)
+      if (!errors[k] && (ans == K || values[k] > values[ans]))
+        ans = k;
+    if (ans == K)
+      rethrow_exception(errors[0]);
+
+    x = points[ans];
+    value = values[ans];
+    return ans;
+  }
+};
@@ -0,0 +1,57 @@
+#ifndef GPLIB_MULTISTART
+#define GPLIB_MULTISTART
+
+#include "arena.hpp"
+
+#include <armadillo>
+#include <functional>
+#include <vector>
+
+#include "random.hpp"
+
+namespace gplib {
+
+  /**
+   *  Designs used to place the starting points of a multi-start training.
+   **/
+  enum start_design {LATIN_HYPERCUBE, SOBOL};
+
+  /**
+   *  Returns n points inside the box [lower_bounds, upper_bounds], one per
+   *  row. Parameters with equal bounds keep that value.
+   *  @param n : Number of points.
+   *  @param lower_bounds : Lower bound of each parameter, must be finite.
+   *  @param upper_bounds : Upper bound of each parameter, must be finite.
+   *  @param design : LATIN_HYPERCUBE or SOBOL.
+   *  @param rng : Stream used to draw the design.
+   **/
+  arma::mat starting_points(size_t n, const std::vector<double> &lower_bounds,
+      const std::vector<double> &upper_bounds, int design, rng_stream &rng);
+
+  /**
+   *  Runs a local maximization from each row of starts concurrently and
+   *  returns the index of the best one (the first one on ties).
+   *
+   *  If drop_margin is finite every start first gets a quarter of the
+   *  evaluations, then the ones whose value is more than drop_margin below
+   *  the best are stopped and the rest continue with the remaining
+   *  evaluations. Starts that throw a runtime_error (e.g. nlopt round-off
+   *  errors) are dropped, if all of them fail the error is rethrown.
+   *  @param starts : Starting points, one per row.
+   *  @param max_iter : Maximum number of evaluations of each start.
+   *  @param drop_margin : Margin on the objective to stop losing starts,
+   *                       HUGE_VAL runs all of them to the end.
+   *  @param run : run(k, x, max_iter) maximizes from x for at most max_iter
+   *               evaluations, leaves the final point in x and returns its
+   *               value. Calls with different k run concurrently.
+   *  @param x : Output, final point of the best start.
+   *  @param value : Output, final value of the best start.
+   *  @param n_threads : Maximum number of starts running at the same time,
+   *                     0 means default_threads().
+   **/
+  size_t multi_start(const arma::mat &starts, int max_iter, double drop_margin,
+      const std::function<double(size_t, std::vector<double> &, int)> &run,
+      std::vector<double> &x, double &value, size_t n_threads = 0);
+};
+
+#endif
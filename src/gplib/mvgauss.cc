@@ -6,56 +6,275 @@ using namespace std;
 namespace gplib {
 
   struct mv_gauss::implementation {
+    size_t structure = DENSE;
     vec mean;
-    mat cov;
-    mat cov_chol;
-
-    double log_density(const arma::vec& x, const arma::mat& sigm_inv) {
-      int d = mean.n_elem;
-      double ans = -0.5 * d * log(2 * pi);
-      //Now sum the log of the determinant of the covariance
-      for (int i = 0; i < d; ++i)
-        ans += -log(cov_chol(i, i));
-      vec diff = x - mean;
-      ans += -0.5 * dot(diff, sigm_inv * diff);
+    mat cov;      // Only used by DENSE
+    mat cov_chol; // Only used by DENSE
+    double jitter = 0; // Added to the diagonal of cov to factorize it
+    vec diag;     // Used by DIAGONAL and LOW_RANK
+    mat U;        // Used by LOW_RANK, cov = diagmat(diag) + U * U.t()
+    mat cap_chol; // Used by LOW_RANK, chol(I + U.t() * inv(diagmat(diag)) * U)
+
+    // Factorization of the observed block used by conditional, it is kept
+    // while the observed mask doesn't change. conditional is const, so the
+    // cache is only touched under cache_lock.
+    vector<bool> cached_observed;
+    uvec obs_ix, hidden_ix;
+    mat obs_chol; // DENSE: chol(cov_oo), LOW_RANK: capacitance of Do, Uo
+    mat gain; // cov(hidden, observed) * inv(cov(observed, observed))
+    mat cond_U; // LOW_RANK: Uh * inv(R)
+    mat cond_cov, cond_chol; // LOW_RANK: cond_chol is the capacitance
+    double cond_jitter = 0;
+    cache_mutex cache_lock;
+
+    static vec force_positive(const vec &d) {
+      vec ans = d;
+      double eps = 1e-6;
+      for (size_t i = 0; i < ans.n_elem; ++i)
+        if (ans(i) < eps)
+          ans(i) = eps;
       return ans;
     }
 
-    mat sample(int n_samples) {
+    static mat capacitance_chol(const vec &d, const mat &U) {
+      mat DiU = U.each_col() / d;
+      return chol(eye<mat>(U.n_cols, U.n_cols) + U.t() * DiU);
+    }
+
+    void set_dense(const mat &c) {
+      structure = DENSE;
+      cov = force_diag(force_symmetric(c));
+      jitter = robust_chol(cov, cov_chol);
+      cov.diag() += jitter;
+    }
+
+    void set_diagonal(const vec &d) {
+      structure = DIAGONAL;
+      diag = force_positive(d);
+    }
+
+    void set_low_rank(const vec &d, const mat &u) {
+      structure = LOW_RANK;
+      diag = force_positive(d);
+      U = u;
+      cap_chol = capacitance_chol(diag, U);
+    }
+
+    double log_det() {
+      double ans = 0;
+      if (structure == DENSE) {
+        ans = chol_log_det(cov_chol);
+      } else {
+        ans = accu(log(diag));
+        if (structure == LOW_RANK)
+          // Matrix determinant lemma
+          ans += chol_log_det(cap_chol);
+      }
+      return ans;
+    }
+
+    /**
+     * Returns diff.col(j).t() * inv(cov) * diff.col(j) for each column.
+     **/
+    vec quad_form(const mat &diff) {
+      if (structure == DENSE) {
+        // cov = R' * R, so the quadratic form is ||R' \ diff||^2
+        mat Z = triangular_solve(cov_chol, diff, true, true);
+        return sum(square(Z), 0).t();
+      }
+      mat Di_diff = diff.each_col() / diag;
+      vec ans = sum(diff % Di_diff, 0).t();
+      if (structure == LOW_RANK) {
+        // Woodbury identity
+        mat S = triangular_solve(cap_chol, mat(U.t() * Di_diff), true, true);
+        ans -= sum(square(S), 0).t();
+      }
+      return ans;
+    }
+
+    double log_density(const arma::vec& x) {
+      vec quad = quad_form(x - mean);
+      return -0.5 * (mean.n_elem * log(2 * pi) + log_det() + quad(0));
+    }
+
+    vec log_densities(const arma::mat& X) {
+      // One triangular solve for all the points (one per column of diff)
+      mat diff = X.t();
+      diff.each_col() -= mean;
+      vec ans = -0.5 * quad_form(diff);
+      ans -= 0.5 * (mean.n_elem * log(2 * pi) + log_det());
+      return ans;
+    }
+
+    size_t n_noise() {
+      return mean.n_elem + (structure == LOW_RANK ? U.n_cols : 0);
+    }
+
+    /**
+     * Maps standard normal rows (n_noise() columns) to samples with zero
+     * mean and the covariance of the distribution.
+     **/
+    mat color(const mat &Z, const vec &std_dev) {
       size_t d = mean.n_elem;
-      mat ans = randn(n_samples, d) * cov_chol;
+      if (structure == DENSE)
+        return Z * cov_chol;
+      mat ans = Z.cols(0, d - 1);
+      ans.each_row() %= std_dev.t();
+      if (structure == LOW_RANK && U.n_cols > 0)
+        ans += Z.cols(d, d + U.n_cols - 1) * U.t();
+      return ans;
+    }
+
+    mat sample(int n_samples) {
+      mat ans = color(randn(n_samples, n_noise()), sqrt(diag));
+      ans.each_row() += mean.t();
+      return ans;
+    }
+
+    mat sample(size_t n_samples, rng_stream &rng, size_t n_threads) {
+      // The tile size must not depend on the number of threads, otherwise
+      // the products would be blocked differently.
+      const size_t tile = 256;
+      size_t n_tiles = (n_samples + tile - 1) / tile;
+      uint64_t first = rng.position();
+      vec std_dev = sqrt(diag);
+      mat ans(n_samples, mean.n_elem);
+      parallel_for(0, n_tiles, [&](size_t t) {
+        size_t begin = t * tile;
+        size_t rows = min(tile, n_samples - begin);
+        mat Z = rng.randn_at(first + begin, rows, n_noise());
+        ans.rows(begin, begin + rows - 1) = color(Z, std_dev);
+      }, n_threads);
+      rng.skip(n_samples);
       ans.each_row() += mean.t();
       return ans;
     }
 
+    mat get_cov() {
+      if (structure == DIAGONAL)
+        return diagmat(diag);
+      if (structure == LOW_RANK)
+        return diagmat(diag) + U * U.t();
+      return cov;
+    }
+
+    mat get_cov_chol() {
+      if (structure == DIAGONAL)
+        return diagmat(sqrt(diag));
+      if (structure == LOW_RANK)
+        return chol(get_cov());
+      return cov_chol;
+    }
+
+    mat get_cov_inv() {
+      if (structure == DIAGONAL)
+        return diagmat(1.0 / diag);
+      if (structure == LOW_RANK) {
+        mat G = triangular_solve(cap_chol, mat((U.each_col() / diag).t()),
+            true, true);
+        return diagmat(1.0 / diag) - G.t() * G;
+      }
+      return chol_solve(cov_chol, eye<mat>(cov.n_rows, cov.n_cols));
+    }
+
     mv_gauss marginalize_hidden(const vector<bool>& observed) {
-      vector<size_t> observed_ids;
-      for (size_t i = 0; i < observed.size(); ++i)
-        if (observed[i]) observed_ids.push_back(i);
+      vector<uword> observed_ids, hidden_ids;
+      split_indices(observed, observed_ids, hidden_ids);
+      uvec ix(observed_ids);
+
+      mv_gauss ans;
+      ans.pimpl->mean = mean(ix);
+      if (structure == DIAGONAL) {
+        ans.pimpl->set_diagonal(diag(ix));
+        return ans;
+      }
+      if (structure == LOW_RANK) {
+        ans.pimpl->set_low_rank(diag(ix), U.rows(ix));
+        return ans;
+      }
 
       size_t n = observed_ids.size();
-      vec new_mean(n);
       mat new_cov(n, n);
-      for (size_t i = 0; i < n; ++i) {
-        new_mean[i] = mean[observed_ids[i]];
+      for (size_t i = 0; i < n; ++i)
         for (size_t j = 0; j < n; ++j)
           new_cov(i, j) = cov(observed_ids[i], observed_ids[j]);
-      }
-      return mv_gauss(new_mean, new_cov);
+      return mv_gauss(ans.pimpl->mean, new_cov);
     }
 
-    mv_gauss conditional(const arma::vec &observation, const vector<bool> &observed) {
+    void factorize_observed(const vector<bool> &observed) {
       vector<uword> v_obs_ix, v_hidden_ix;
-
       split_indices(observed, v_obs_ix, v_hidden_ix);
+      obs_ix = uvec(v_obs_ix);
+      hidden_ix = uvec(v_hidden_ix);
+      cached_observed = observed;
+      if (structure == DIAGONAL)
+        return;
+      if (structure == LOW_RANK) {
+        // With C = I + Uo' * inv(Do) * Uo = R' * R the conditional
+        // covariance is diagmat(Dh) + (Uh * inv(R)) * (Uh * inv(R))'
+        vec d_obs = diag(obs_ix);
+        mat U_obs = U.rows(obs_ix), U_hidden = U.rows(hidden_ix);
+        obs_chol = capacitance_chol(d_obs, U_obs);
+        cond_U = triangular_solve(obs_chol, mat(U_hidden.t()), true, true).t();
+        cond_chol = capacitance_chol(diag(hidden_ix), cond_U);
+        return;
+      }
 
-      uvec obs_ix(v_obs_ix), hidden_ix(v_hidden_ix);
-      mat tmp = cov(hidden_ix, obs_ix) * inv(cov(obs_ix, obs_ix));
-      vec new_mean = mean(hidden_ix) + tmp * (observation(obs_ix) - mean(obs_ix));
-      mat new_cov  = cov(hidden_ix, hidden_ix) - tmp * cov(obs_ix, hidden_ix);
-      return mv_gauss(new_mean, new_cov);
+      size_t n = mean.n_elem, n_obs = obs_ix.n_elem;
+      mat cov_oo, cov_oh, cov_hh;
+      if (n_obs > 0 && n_obs < n && obs_ix(n_obs - 1) == n_obs - 1) {
+        // Observed variables come first, avoid the indexed copies.
+        cov_oo = cov.submat(0, 0, n_obs - 1, n_obs - 1);
+        cov_oh = cov.submat(0, n_obs, n_obs - 1, n - 1);
+        cov_hh = cov.submat(n_obs, n_obs, n - 1, n - 1);
+      } else {
+        cov_oo = cov(obs_ix, obs_ix);
+        cov_oh = cov(obs_ix, hidden_ix);
+        cov_hh = cov(hidden_ix, hidden_ix);
+      }
+
+      // cov_oo = R' * R, then gain = cov_ho * inv(cov_oo) = (R \ (R' \ cov_oh))'
+      robust_chol(cov_oo, obs_chol);
+      mat V = triangular_solve(obs_chol, cov_oh, true, true);
+      gain = triangular_solve(obs_chol, V).t();
+      cond_cov = force_diag(force_symmetric(cov_hh - V.t() * V));
+      cond_jitter = robust_chol(cond_cov, cond_chol);
+      cond_cov.diag() += cond_jitter;
     }
 
+    mv_gauss conditional(const arma::vec &observation, const vector<bool> &observed) {
+      lock_guard<mutex> lock(cache_lock);
+      if (observed != cached_observed)
+        factorize_observed(observed);
+
+      vec diff = observation(obs_ix) - mean(obs_ix);
+      mv_gauss ans;
+      if (structure == DIAGONAL) {
+        // Independent variables, the observations don't change anything.
+        ans.pimpl->mean = mean(hidden_ix);
+        ans.pimpl->set_diagonal(diag(hidden_ix));
+      } else if (structure == LOW_RANK) {
+        // The mean is mean_h + Uh * inv(C) * Uo' * inv(Do) * diff, only the
+        // solve with the cached R depends on the observation.
+        vec t = triangular_solve(obs_chol,
+            vec(U.rows(obs_ix).t() * (diff / diag(obs_ix))), true, true);
+        ans.pimpl->mean = mean(hidden_ix) + cond_U * t;
+        ans.pimpl->structure = LOW_RANK;
+        ans.pimpl->diag = diag(hidden_ix);
+        ans.pimpl->U = cond_U;
+        ans.pimpl->cap_chol = cond_chol;
+      } else {
+        ans.pimpl->mean = mean(hidden_ix) + gain * diff;
+        ans.pimpl->cov = cond_cov;
+        ans.pimpl->cov_chol = cond_chol;
+        ans.pimpl->jitter = cond_jitter;
+      }
+      return ans;
+    }
+
+    void clear_cache() {
+      cached_observed.clear();
+    }
   };
 
 
@@ -65,27 +284,39 @@ namespace gplib {
 
   mv_gauss::mv_gauss(const vec& mean, const mat& cov) : mv_gauss() {
     pimpl->mean = mean;
-    pimpl->cov = force_diag(force_symmetric(cov));
-    pimpl->cov_chol = chol(pimpl-> cov);
+    pimpl->set_dense(cov);
   }
 
   mv_gauss::mv_gauss(const mv_gauss& other) : mv_gauss() {
-    pimpl->mean = other.get_mean();
-    pimpl->cov = other.get_cov();
-    pimpl->cov_chol = other.get_cov_chol();
+    *pimpl = *other.pimpl;
   }
 
   mv_gauss::~mv_gauss() {
     delete pimpl;
   }
 
+  mv_gauss mv_gauss::diagonal(const vec &mean, const vec &var) {
+    mv_gauss ans;
+    ans.pimpl->mean = mean;
+    ans.pimpl->set_diagonal(var);
+    return ans;
+  }
+
+  mv_gauss mv_gauss::low_rank(const vec &mean, const vec &diag,
+      const mat &U) {
+    mv_gauss ans;
+    ans.pimpl->mean = mean;
+    ans.pimpl->set_low_rank(diag, U);
+    return ans;
+  }
+
   void mv_gauss::set_mean(const vec& mean) {
     pimpl->mean = mean;
   }
 
   void mv_gauss::set_cov(const mat& cov) {
-    pimpl->cov = force_diag(cov);
-    pimpl->cov_chol = chol(cov);
+    pimpl->set_dense(cov);
+    pimpl->clear_cache();
   }
 
   vec mv_gauss::get_mean() const {
@@ -93,25 +324,35 @@ namespace gplib {
   }
 
   mat mv_gauss::get_cov() const {
-    return pimpl->cov;
+    return pimpl->get_cov();
   }
 
   mat mv_gauss::get_cov_chol() const {
-    return pimpl->cov_chol;
+    return pimpl->get_cov_chol();
   }
 
   mat mv_gauss::get_cov_inv() const {
-    mat tmp = upper_triangular_inverse(pimpl->cov_chol);
-    return tmp * tmp.t();
+    return pimpl->get_cov_inv();
   }
 
   size_t mv_gauss::dimension() const {
     return pimpl->mean.n_rows;
   }
 
+  size_t mv_gauss::structure() const {
+    return pimpl->structure;
+  }
+
+  double mv_gauss::jitter() const {
+    return pimpl->jitter;
+  }
+
   double mv_gauss::log_density(const arma::vec& x) const {
-    mat sigm_inv = get_cov_inv();
-    return pimpl->log_density(x, sigm_inv);
+    return pimpl->log_density(x);
+  }
+
+  vec mv_gauss::log_densities(const arma::mat& X) const {
+    return pimpl->log_densities(X);
   }
 
   double mv_gauss::density(const arma::vec& x) const {
@@ -122,6 +363,11 @@ namespace gplib {
     return pimpl->sample(n_samples);
   }
 
+  mat mv_gauss::sample(size_t n_samples, rng_stream &rng,
+      size_t n_threads) const {
+    return pimpl->sample(n_samples, rng, n_threads);
+  }
+
   mv_gauss mv_gauss::marginalize_hidden(const vector<bool>& observed) const {
     return pimpl->marginalize_hidden(observed);
   }
@@ -132,9 +378,7 @@ namespace gplib {
 
   mv_gauss mv_gauss::operator=(const mv_gauss &other) {
     if (&other != this) {
-      pimpl->mean = other.get_mean();
-      pimpl->cov = other.get_cov();
-      pimpl->cov_chol = other.get_cov_chol();
+      *pimpl = *other.pimpl;
     }
     return *this;
   }
@@ -1,9 +1,13 @@
 #ifndef GPLIB_MVGAUSS
 #define GPLIB_MVGAUSS
 
+#include "arena.hpp"
+
 #include <armadillo>
 #include <vector>
 
+#include "random.hpp"
+
 namespace gplib {
 
   class mv_gauss {
@@ -37,6 +41,24 @@ namespace gplib {
        **/
       ~mv_gauss();
 
+      /**
+       *  Returns a Gaussian distribution with diagonal covariance, only the
+       *  variances are stored.
+       *  @param mean : Vector of means.
+       *  @param var : Vector of variances.
+       **/
+      static mv_gauss diagonal(const arma::vec &mean, const arma::vec &var);
+      /**
+       *  Returns a Gaussian distribution with covariance diagmat(diag) + U * U',
+       *  the dense covariance is never formed, so memory scales with the
+       *  number of columns of U.
+       *  @param mean : Vector of means.
+       *  @param diag : Vector with the diagonal part of the covariance.
+       *  @param U : Matrix with the low rank factor of the covariance.
+       **/
+      static mv_gauss low_rank(const arma::vec &mean, const arma::vec &diag,
+          const arma::mat &U);
+
       /**
        *  Sets the mean vector to the Gaussian distribution.
        *  @param mean : Vector of means.
@@ -52,7 +74,8 @@ namespace gplib {
        **/
       arma::vec get_mean() const;
       /**
-       *  Gets the covanriance matrix.
+       *  Gets the covanriance matrix, structured covariances are returned as
+       *  dense matrices.
        **/
       arma::mat get_cov() const;
       /**
@@ -67,6 +90,15 @@ namespace gplib {
        *  Returns the dimensionality of the Gaussian ditribution.
        **/
       size_t dimension() const;
+      /**
+       *  Returns how the covariance is stored (DENSE, DIAGONAL or LOW_RANK).
+       **/
+      size_t structure() const;
+      /**
+       *  Returns the jitter added to the diagonal of a dense covariance to
+       *  make it positive definite, 0 if it was not needed.
+       **/
+      double jitter() const;
 
       /**
        *  Returns n_samples samples in a matrix with n_samples rows and D
@@ -74,12 +106,29 @@ namespace gplib {
        *  @param n_samples : number of samples.
        **/
       arma::mat sample(int n_samples) const;
+      /**
+       *  Returns n_samples samples drawn from the provided stream, in a
+       *  matrix with n_samples rows and D columns. The samples are generated
+       *  in tiles of fixed size spread over the thread pool, so the result
+       *  is the same for any number of threads.
+       *  @param n_samples : number of samples.
+       *  @param rng : stream to draw from, it is advanced by n_samples rows.
+       *  @param n_threads : number of threads, 0 means default_threads().
+       **/
+      arma::mat sample(size_t n_samples, rng_stream &rng,
+          size_t n_threads = 0) const;
 
       /**
        *  Returns the logartihm density of the Gaussian distribution
        *  @param x : Vector of random variables.
        **/
       double log_density(const arma::vec &x) const;
+      /**
+       *  Returns the logarithm density of the Gaussian distribution for
+       *  several points at once, with a single triangular solve.
+       *  @param X : Matrix of random variables, each row is one point.
+       **/
+      arma::vec log_densities(const arma::mat &X) const;
       /**
        *  Returns the density of the Gaussian ditribution
        *  @param x : Vector of random variables.
@@ -99,6 +148,10 @@ namespace gplib {
        *  Returns the conditional distribution of the hidden variables given the
        *  an observation of the observed variables. Only the values for which
        *  the observed vector is true are considered on vector observation.
+       *  The factorization of the observed block (or the capacitance of the
+       *  low-rank structure) is cached, so conditioning again with the same
+       *  observed vector only costs a matrix-vector product. Concurrent
+       *  calls are safe, the cache is updated under a lock.
        *  @param observation : vector, indicates the observed values.
        *  @param observed : boolean vector, indicates which values are observed.
        **/
@@ -110,6 +163,7 @@ namespace gplib {
        *  @param other : Gaussian distribution to be set.
        **/
       mv_gauss operator=(const mv_gauss &other);
+      enum {DENSE, DIAGONAL, LOW_RANK};
   };
 };
 
@@ -0,0 +1,155 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace gplib {
+
+  namespace {
+
+    struct job {
+      atomic<size_t> next;
+      size_t end;
+      const function<void(size_t)> *f;
+      size_t pending;
+      mutex m;
+      condition_variable finished;
+      atomic<bool> failed;
+      exception_ptr error;
+
+      // Takes indices until there is nothing left, counting how many it ran.
+      void work() {
+        size_t ran = 0;
+        for (size_t i = next++; i < end; i = next++) {
+          try {
+            if (!failed)
+              (*f)(i);
+          } catch (...) {
+            lock_guard<mutex> lock(m);
+            if (!failed)
+              error = current_exception();
+            failed = true;
+          }
+          ++ran;
+        }
+        if (ran > 0) {
+          lock_guard<mutex> lock(m);
+          pending -= ran;
+          if (pending == 0)
+            finished.notify_all();
+        }
+      }
+    };
+
+    class thread_pool {
+      private:
+        vector<thread> workers;
+        deque<shared_ptr<job>> tasks;
+        mutex m;
+        condition_variable available;
+        bool stop = false;
+
+        void loop() {
+          while (true) {
+            shared_ptr<job> task;
+            {
+              unique_lock<mutex> lock(m);
+              available.wait(lock, [this] { return stop || !tasks.empty(); });
+              if (stop && tasks.empty())
+                return;
+              task = tasks.front();
+              tasks.pop_front();
+            }
+            task-> work();
+          }
+        }
+
+      public:
+        thread_pool(size_t n_workers) {
+          for (size_t i = 0; i < n_workers; ++i)
+            workers.emplace_back(&thread_pool::loop, this);
+        }
+
+        ~thread_pool() {
+          {
+            lock_guard<mutex> lock(m);
+            stop = true;
+          }
+          available.notify_all();
+          for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        }
+
+        size_t size() const {
+          return workers.size();
+        }
+
+        void push(const shared_ptr<job> &task, size_t copies) {
+          {
+            lock_guard<mutex> lock(m);
+            for (size_t i = 0; i < copies; ++i)
+              tasks.push_back(task);
+          }
+          available.notify_all();
+        }
+    };
+
+    size_t hardware_threads() {
+      size_t n = thread::hardware_concurrency();
+      return n == 0 ? 1 : n;
+    }
+
+    atomic<size_t> n_default_threads(0);
+
+    thread_pool &pool() {
+      static thread_pool instance(hardware_threads() - 1);
+      return instance;
+    }
+  };
+
+  size_t default_threads() {
+    size_t n = n_default_threads;
+    return n == 0 ? hardware_threads() : n;
+  }
+
+  void set_default_threads(size_t n_threads) {
+    n_default_threads = n_threads;
+  }
+
+  void parallel_for(size_t begin, size_t end,
+      const function<void(size_t)> &f, size_t n_threads) {
+    if (begin >= end)
+      return;
+    if (n_threads == 0)
+      n_threads = default_threads();
+    n_threads = min(n_threads, end - begin);
+    if (n_threads <= 1) {
+      for (size_t i = begin; i < end; ++i)
+        f(i);
+      return;
+    }
+
+    auto task = make_shared<job>();
+    task-> next = begin;
+    task-> end = end;
+    task-> f = &f;
+    task-> pending = end - begin;
+    task-> failed = false;
+    pool().push(task, min(n_threads - 1, pool().size()));
+
+    task-> work();
+    unique_lock<mutex> lock(task-> m);
+    task-> finished.wait(lock, [&task] { return task-> pending == 0; });
+    if (task-> error)
+      rethrow_exception(task-> error);
+  }
+};
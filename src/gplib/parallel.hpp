@@ -0,0 +1,50 @@
+#ifndef GPLIB_PARALLEL
+#define GPLIB_PARALLEL
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+namespace gplib {
+
+  /**
+   *  Returns the number of threads used when a parallel call receives
+   *  n_threads = 0. By default it is the number of hardware threads.
+   **/
+  size_t default_threads();
+
+  /**
+   *  Sets the number of threads used when a parallel call receives
+   *  n_threads = 0.
+   *  @param n_threads : Number of threads, 0 restores the hardware default.
+   **/
+  void set_default_threads(size_t n_threads);
+
+  /**
+   *  Calls f(i) for each i in [begin, end) using the library thread pool.
+   *  The calling thread also takes work, so nested calls never deadlock.
+   *  The order in which the indices are processed is not specified, callers
+   *  needing deterministic results should write each result to its own slot
+   *  and reduce afterwards. The first exception thrown by f is rethrown.
+   *  @param begin : First index.
+   *  @param end : One past the last index.
+   *  @param f : Function to call for each index.
+   *  @param n_threads : Maximum number of threads to use, 0 means
+   *                     default_threads().
+   **/
+  void parallel_for(size_t begin, size_t end,
+      const std::function<void(size_t)> &f, size_t n_threads = 0);
+
+  /**
+   *  Mutex for the caches that const methods fill, it can be a member of
+   *  copyable objects: a copy gets its own unlocked mutex.
+   **/
+  class cache_mutex : public std::mutex {
+    public:
+      cache_mutex() {}
+      cache_mutex(const cache_mutex &) : std::mutex() {}
+      cache_mutex &operator=(const cache_mutex &) { return *this; }
+  };
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "gplib.hpp"
+
+using namespace arma;
+using namespace std;
+
+namespace gplib {
+
+  namespace {
+    const uint32_t philox_m0 = 0xD2511F53;
+    const uint32_t philox_m1 = 0xCD9E8D57;
+    const uint32_t philox_w0 = 0x9E3779B9;
+    const uint32_t philox_w1 = 0xBB67AE85;
+
+    void philox(uint32_t ctr[4], uint32_t key[2]) {
+      uint32_t k0 = key[0], k1 = key[1];
+      for (int round = 0; round < 10; ++round) {
+        uint64_t p0 = uint64_t(philox_m0) * ctr[0];
+        uint64_t p1 = uint64_t(philox_m1) * ctr[2];
+        uint32_t c0 = uint32_t(p1 >> 32) ^ ctr[1] ^ k0;
+        uint32_t c2 = uint32_t(p0 >> 32) ^ ctr[3] ^ k1;
+        ctr[0] = c0;
+        ctr[1] = uint32_t(p1);
+        ctr[2] = c2;
+        ctr[3] = uint32_t(p0);
+        k0 += philox_w0;
+        k1 += philox_w1;
+      }
+    }
+
+    // Finalizer of splitmix64, a bijection of the 64 bit words.
+    uint64_t mix64(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+    // Key from the whole seed and stream id, two (seed, stream) pairs only
+    // share it through a collision of the hash, not by moving bits from one
+    // to the other.
+    uint64_t stream_key(uint64_t seed, uint64_t stream) {
+      return mix64(mix64(seed) + 0x9E3779B97F4A7C15ull * (stream + 1));
+    }
+
+    // Four random words for the pair of columns (2 * pair, 2 * pair + 1).
+    void block(uint64_t key, uint64_t stream, uint64_t row, uint32_t pair,
+        uint32_t out[4]) {
+      out[0] = pair;
+      out[1] = uint32_t(row);
+      out[2] = uint32_t(row >> 32);
+      out[3] = uint32_t(stream);
+      uint32_t k[2] = {uint32_t(key), uint32_t(key >> 32)};
+      philox(out, k);
+    }
+
+    // Uniform in [0, 1) with 53 random bits.
+    double to_unit(uint32_t hi, uint32_t lo) {
+      uint64_t bits = (uint64_t(hi) << 21) ^ (lo >> 11);
+      return bits * (1.0 / 9007199254740992.0);
+    }
+
+    mat generate(uint64_t seed, uint64_t stream, uint64_t row, size_t n_rows,
+        size_t n_cols, bool normal) {
+      mat ans(n_rows, n_cols);
+      uint32_t r[4];
+      uint64_t key = stream_key(seed, stream);
+      for (size_t i = 0; i < n_rows; ++i) {
+        for (size_t j = 0; j < n_cols; j += 2) {
+          block(key, stream, row + i, j / 2, r);
+          double u1 = to_unit(r[0], r[1]);
+          double u2 = to_unit(r[2], r[3]);
+          double a, b;
+          if (normal) {
+            // Box-Muller, 1 - u1 is in (0, 1]
+            double rad = sqrt(-2.0 * log(1.0 - u1));
+            a = rad * cos(2.0 * pi * u2);
+            b = rad * sin(2.0 * pi * u2);
+          } else {
+            a = u1;
+            b = u2;
+          }
+          ans(i, j) = a;
+          if (j + 1 < n_cols)
+            ans(i, j + 1) = b;
+        }
+      }
+      return ans;
+    }
+
+    // True if the polynomial over GF(2) with coefficients in the bits of
+    // poly (degree s) is primitive, that is x has order 2^s - 1 modulo it.
+    bool primitive(uint32_t poly, int s) {
+      uint32_t period = (1u << s) - 1, state = 1;
+      for (uint32_t k = 1; k <= period; ++k) {
+        state <<= 1;
+        if (state & (1u << s))
+          state ^= poly;
+        if (state == 1)
+          return k == period;
+      }
+      return false;
+    }
+  };
+
+  rng_stream::rng_stream(uint64_t seed, uint64_t stream)
+    : seed_value(seed), stream_id(stream), counter(0) {}
+
+  mat rng_stream::randn(size_t n_rows, size_t n_cols) {
+    mat ans = randn_at(counter, n_rows, n_cols);
+    counter += n_rows;
+    return ans;
+  }
+
+  mat rng_stream::randu(size_t n_rows, size_t n_cols) {
+    mat ans = randu_at(counter, n_rows, n_cols);
+    counter += n_rows;
+    return ans;
+  }
+
+  mat rng_stream::randn_at(uint64_t row, size_t n_rows, size_t n_cols) const {
+    return generate(seed_value, stream_id, row, n_rows, n_cols, true);
+  }
+
+  mat rng_stream::randu_at(uint64_t row, size_t n_rows, size_t n_cols) const {
+    return generate(seed_value, stream_id, row, n_rows, n_cols, false);
+  }
+
+  void rng_stream::skip(uint64_t n_rows) {
+    counter += n_rows;
+  }
+
+  uint64_t rng_stream::position() const {
+    return counter;
+  }
+
+  void rng_stream::set_position(uint64_t row) {
+    counter = row;
+  }
+
+  uint64_t rng_stream::seed() const {
+    return seed_value;
+  }
+
+  uint64_t rng_stream::stream() const {
+    return stream_id;
+  }
+
+  mat latin_hypercube(size_t n, size_t dim, rng_stream &rng) {
+    mat order = rng.randu(n, dim);
+    mat ans = rng.randu(n, dim);
+    for (size_t j = 0; j < dim; ++j) {
+      uvec perm = sort_index(order.col(j));
+      for (size_t i = 0; i < n; ++i)
+        ans(i, j) = (perm(i) + ans(i, j)) / n;
+    }
+    return ans;
+  }
+
+  mat sobol(size_t n, size_t dim, rng_stream &rng) {
+    const int bits = 32;
+    // Direction numbers V[j][k] = m_k * 2^(32 - k), the first dimension is
+    // the van der Corput sequence.
+    vector<vector<uint32_t>> V(dim, vector<uint32_t>(bits));
+    for (int k = 0; k < bits; ++k)
+      V[0][k] = 1u << (bits - 1 - k);
+
+    // The initial direction numbers only need to be odd and below 2^k, they
+    // are drawn from a fixed stream so the sequence is always the same.
+    rng_stream directions(0x50b01, 0);
+    uint32_t poly = 1;
+    int s = 0;
+    for (size_t j = 1; j < dim; ++j) {
+      do {
+        poly += 2;
+        if (poly >> (s + 1))
+          ++s;
+      } while (!primitive(poly, s));
+
+      mat u = directions.randu(1, s);
+      for (int k = 0; k < s && k < bits; ++k) {
+        uint32_t m = 2 * uint32_t(u(0, k) * (1u << k)) + 1;
+        V[j][k] = m << (bits - 1 - k);
+      }
+      for (int k = s; k < bits; ++k) {
+        uint32_t v = V[j][k - s] ^ (V[j][k - s] >> s);
+        for (int i = 1; i < s; ++i)
+          if ((poly >> (s - i)) & 1)
+            v ^= V[j][k - i];
+        V[j][k] = v;
+      }
+    }
+
+    // Gray code order, point i flips the direction of the lowest zero bit
+    // of i - 1.
+    mat shift = rng.randu(1, dim);
+    vector<uint32_t> x(dim, 0), d(dim);
+    for (size_t j = 0; j < dim; ++j)
+      d[j] = uint32_t(shift(0, j) * 4294967296.0);
+    mat ans(n, dim);
+    for (size_t i = 0; i < n; ++i) {
+      if (i > 0) {
+        int c = 0;
+        for (size_t v = i - 1; v & 1; v >>= 1)
+          ++c;
+        for (size_t j = 0; j < dim; ++j)
+          x[j] ^= V[j][c];
+      }
+      for (size_t j = 0; j < dim; ++j)
+        ans(i, j) = (x[j] ^ d[j]) * (1.0 / 4294967296.0);
+    }
+    return ans;
+  }
+};
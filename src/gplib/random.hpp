@@ -0,0 +1,108 @@
+#ifndef GPLIB_RANDOM
+#define GPLIB_RANDOM
+
+#include "arena.hpp"
+
+#include <armadillo>
+#include <cstdint>
+
+namespace gplib {
+
+  class rng_stream {
+    /**
+     *  Counter based random number stream (Philox4x32-10).
+     *
+     *  Every value is a pure function of (seed, stream, row, column), so the
+     *  numbers do not depend on how the rows are split between threads, and
+     *  streams with different ids can be used concurrently without sharing
+     *  any state.
+     *  @ref : http://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+     **/
+    private:
+      uint64_t seed_value;
+      uint64_t stream_id;
+      uint64_t counter;
+    public:
+      /**
+       *  Constructor
+       *  @param seed : Seed of the generator.
+       *  @param stream : Identifier of the stream, streams with the same seed
+       *                  and different ids are independent.
+       **/
+      rng_stream(uint64_t seed = 0, uint64_t stream = 0);
+
+      /**
+       *  Returns a matrix of standard normal values and advances the stream
+       *  by n_rows rows.
+       *  @param n_rows : Number of rows.
+       *  @param n_cols : Number of columns.
+       **/
+      arma::mat randn(size_t n_rows, size_t n_cols);
+      /**
+       *  Returns a matrix of uniform values in [0, 1) and advances the stream
+       *  by n_rows rows.
+       *  @param n_rows : Number of rows.
+       *  @param n_cols : Number of columns.
+       **/
+      arma::mat randu(size_t n_rows, size_t n_cols);
+      /**
+       *  Returns the standard normal values of rows [row, row + n_rows) of
+       *  the stream, without changing its position.
+       *  @param row : First row to generate.
+       *  @param n_rows : Number of rows.
+       *  @param n_cols : Number of columns.
+       **/
+      arma::mat randn_at(uint64_t row, size_t n_rows, size_t n_cols) const;
+      /**
+       *  Returns the uniform values of rows [row, row + n_rows) of the
+       *  stream, without changing its position.
+       *  @param row : First row to generate.
+       *  @param n_rows : Number of rows.
+       *  @param n_cols : Number of columns.
+       **/
+      arma::mat randu_at(uint64_t row, size_t n_rows, size_t n_cols) const;
+      /**
+       *  Advances the stream by n_rows rows.
+       **/
+      void skip(uint64_t n_rows);
+      /**
+       *  Returns the first row that will be used by the next call.
+       **/
+      uint64_t position() const;
+      /**
+       *  Moves the stream to the given row.
+       **/
+      void set_position(uint64_t row);
+      /**
+       *  Returns the seed of the stream.
+       **/
+      uint64_t seed() const;
+      /**
+       *  Returns the identifier of the stream.
+       **/
+      uint64_t stream() const;
+  };
+
+  /**
+   *  Returns n points of a Latin hypercube in [0, 1)^dim, one per row. Each
+   *  column has exactly one point in each of the n strata [k / n, (k + 1) / n).
+   *  @param n : Number of points.
+   *  @param dim : Dimension of the points.
+   *  @param rng : Stream used for the permutations and the offsets.
+   **/
+  arma::mat latin_hypercube(size_t n, size_t dim, rng_stream &rng);
+
+  /**
+   *  Returns the first n points of a Sobol sequence in [0, 1)^dim, one per
+   *  row, with a random digital shift drawn from rng. The direction numbers
+   *  come from the primitive polynomials over GF(2) in increasing degree, so
+   *  any dimension is supported.
+   *  @param n : Number of points.
+   *  @param dim : Dimension of the points.
+   *  @param rng : Stream used for the digital shift.
+   *  @ref : https://web.maths.unsw.edu.au/~fkuo/sobol/joe-kuo-notes.pdf
+   **/
+  arma::mat sobol(size_t n, size_t dim, rng_stream &rng);
+};
+
+#endif
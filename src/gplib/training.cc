@@ -0,0 +1,122 @@
+#include "gplib.hpp"
+#include <nlopt.hpp>
+
+using namespace arma;
+using namespace std;
+
+namespace gplib {
+
+  namespace {
+    typedef function<double(const vector<double> &, vector<double> &)>
+      objective_fn;
+
+    struct context {
+      const objective_fn *f;
+      vector<int> transforms;
+      vector<double> theta, grad;
+    };
+
+    double callback(const vector<double> &u, vector<double> &grad,
+        void *data) {
+      context &c = *(context *) data;
+      for (size_t i = 0; i < u.size(); ++i)
+        c.theta[i] = from_unconstrained(u[i], c.transforms[i]);
+      c.grad.resize(grad.size());
+      double ans;
+      try {
+        ans = (*c.f)(c.theta, c.grad);
+      } catch (const factorization_error &) {
+        fill(grad.begin(), grad.end(), 0.0);
+        return failed_objective;
+      }
+      for (size_t i = 0; i < grad.size(); ++i)
+        grad[i] = c.grad[i] * transform_derivative(u[i], c.transforms[i]);
+      return ans;
+    }
+
+    nlopt::algorithm nlopt_algorithm(int algorithm) {
+      switch (algorithm) {
+        case MMA: return nlopt::LD_MMA;
+        case LBFGS: return nlopt::LD_LBFGS;
+        case SLSQP: return nlopt::LD_SLSQP;
+        case CCSAQ: return nlopt::LD_CCSAQ;
+        case TNEWTON: return nlopt::LD_TNEWTON_PRECOND_RESTART;
+        case VAR2: return nlopt::LD_VAR2;
+      }
+      throw logic_error("Unknown optimizer");
+    }
+  };
+
+  double from_unconstrained(double u, int t) {
+    if (t == LOG)
+      return exp(u);
+    if (t == SOFTPLUS) // log(1 + exp(u)) without overflow
+      return u > 0 ? u + log1p(exp(-u)) : log1p(exp(u));
+    return u;
+  }
+
+  double to_unconstrained(double theta, int t) {
+    if (t == IDENTITY)
+      return theta;
+    if (theta < 0)
+      throw logic_error("Log and softplus transforms need non negative values");
+    if (theta == 0)
+      return -HUGE_VAL;
+    if (t == LOG)
+      return log(theta);
+    // log(exp(theta) - 1)
+    return theta > 30 ? theta + log1p(-exp(-theta)) : log(expm1(theta));
+  }
+
+  double transform_derivative(double u, int t) {
+    if (t == LOG)
+      return exp(u);
+    if (t == SOFTPLUS) // sigmoid(u)
+      return u > 0 ? 1.0 / (1.0 + exp(-u)) : exp(u) / (1.0 + exp(u));
+    return 1.0;
+  }
+
+  double maximize(const objective_fn &f, vector<double> &x,
+      const vector<double> &lower_bounds, const vector<double> &upper_bounds,
+      const train_options &options) {
+    size_t n = x.size();
+    context c;
+    c.f = &f;
+    c.transforms.assign(n, IDENTITY);
+    for (size_t i = 0; i < n && i < options.transforms.size(); ++i)
+      c.transforms[i] = options.transforms[i];
+    c.theta.resize(n);
+
+    vector<double> u(n), lb(lower_bounds.size()), ub(upper_bounds.size());
+    for (size_t i = 0; i < n; ++i) {
+      if (c.transforms[i] != IDENTITY && x[i] <= 0)
+        throw logic_error("Transformed parameters must start positive");
+      u[i] = to_unconstrained(x[i], c.transforms[i]);
+    }
+    for (size_t i = 0; i < lb.size() && i < n; ++i)
+      lb[i] = to_unconstrained(lower_bounds[i], c.transforms[i]);
+    for (size_t i = 0; i < ub.size() && i < n; ++i)
+      ub[i] = to_unconstrained(upper_bounds[i], c.transforms[i]);
+
+    nlopt::opt opt(nlopt_algorithm(options.algorithm), n);
+    opt.set_max_objective(callback, &c);
+    opt.set_lower_bounds(lb);
+    opt.set_upper_bounds(ub);
+    opt.set_xtol_rel(options.xtol_rel);
+    if (options.ftol_rel > 0)
+      opt.set_ftol_rel(options.ftol_rel);
+    opt.set_maxeval(options.max_eval);
+    if (options.max_time > 0)
+      opt.set_maxtime(options.max_time);
+
+    double value; //final value of the objective
+    try {
+      opt.optimize(u, value);
+    } catch (const nlopt::roundoff_limited &) {
+      // u and value already hold the best point found
+    }
+    for (size_t i = 0; i < n; ++i)
+      x[i] = from_unconstrained(u[i], c.transforms[i]);
+    return value;
+  }
+};
@@ -0,0 +1,92 @@
+#ifndef GPLIB_TRAINING
+#define GPLIB_TRAINING
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "inducing.hpp"
+
+namespace gplib {
+
+  /**
+   *  Local optimizers available for training, all of them are gradient
+   *  based nlopt algorithms (MMA is nlopt::LD_MMA, LBFGS is nlopt::LD_LBFGS
+   *  and so on).
+   **/
+  enum optimizer {MMA, LBFGS, SLSQP, CCSAQ, TNEWTON, VAR2};
+
+  /**
+   *  Transforms of the parameters. The optimizer works on u and the model
+   *  receives theta = f(u), so the bounds and the gradient are mapped with
+   *  f and the chain rule.
+   *  IDENTITY : theta = u.
+   *  LOG      : theta = exp(u), for positive parameters.
+   *  SOFTPLUS : theta = log(1 + exp(u)), for positive parameters, it is
+   *             close to the identity for large values.
+   **/
+  enum param_transform {IDENTITY, LOG, SOFTPLUS};
+
+  struct train_options {
+    /**
+     *  Settings of a training call. The defaults reproduce the plain
+     *  train(max_iter, tol) calls.
+     **/
+    int algorithm = MMA;
+    int max_eval = 100;      // Maximum number of objective evaluations
+    double max_time = 0;     // Wall time budget in seconds, 0 is no limit
+    double xtol_rel = 1e-4;  // Relative tolerance on the (transformed) params
+    double ftol_rel = 0;     // Relative tolerance on the objective, 0 is off
+    /**
+     *  Transform of each optimized parameter, in the order of the parameter
+     *  vector (for FITC: kernel parameters, pseudo-inputs if optimized and
+     *  sigma). Missing entries are IDENTITY.
+     **/
+    std::vector<int> transforms;
+    /**
+     *  Placement of the pseudo-inputs when train receives their number (see
+     *  inducing_init), and the seed of the KMEANS seeding. A good placement
+     *  reaches the same accuracy with fewer points, often without optimizing
+     *  them.
+     **/
+    int inducing_init = GRID;
+    uint64_t seed = 0;
+  };
+
+  /**
+   *  Returns theta = f(u) for the transform t.
+   **/
+  double from_unconstrained(double u, int t);
+
+  /**
+   *  Returns u such that f(u) = theta, the inverse of from_unconstrained.
+   *  Zero is mapped to -HUGE_VAL by LOG and SOFTPLUS.
+   **/
+  double to_unconstrained(double theta, int t);
+
+  /**
+   *  Returns d theta / d u at u for the transform t.
+   **/
+  double transform_derivative(double u, int t);
+
+  /**
+   *  Maximizes f starting from x with the algorithm, transforms and budgets
+   *  of options, leaving the final point in x. Evaluations where f throws
+   *  factorization_error get failed_objective and a zero gradient, so the
+   *  optimizer moves away instead of aborting. Round-off limited runs keep
+   *  the best point found.
+   *  @param f : f(theta, grad) returns the objective and fills grad when it
+   *             is not empty.
+   *  @param x : Starting point, output the final point.
+   *  @param lower_bounds : Lower bound of each parameter.
+   *  @param upper_bounds : Upper bound of each parameter.
+   *  @param options : Settings of the optimization.
+   *  @return The objective at the final point.
+   **/
+  double maximize(const std::function<double(const std::vector<double> &,
+      std::vector<double> &)> &f, std::vector<double> &x,
+      const std::vector<double> &lower_bounds,
+      const std::vector<double> &upper_bounds, const train_options &options);
+};
+
+#endif
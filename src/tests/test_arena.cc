@@ -0,0 +1,95 @@
+#include <boost/test/unit_test.hpp>
+#include <armadillo>
+#include <cstdint>
+#include <ctime>
+#include <ratio>
+#include <chrono>
+
+#include "gplib/gplib.hpp"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( arena )
+
+BOOST_AUTO_TEST_CASE( arena_reuse ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  void *a = gplib::arena_alloc(1000);
+  BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(a) % 64, 0);
+  gplib::arena_free(a);
+
+  // Same size class, the freed block is reused.
+  void *b = gplib::arena_alloc(990);
+  BOOST_CHECK(a == b);
+  gplib::arena_free(b);
+
+  // The reserved memory stays flat across iterations.
+  size_t reserved = gplib::arena_reserved_bytes();
+  for (size_t i = 0; i < 100; ++i) {
+    void *c = gplib::arena_alloc(1000);
+    void *d = gplib::arena_alloc(50000);
+    gplib::arena_free(d);
+    gplib::arena_free(c);
+    if (i == 0)
+      reserved = gplib::arena_reserved_bytes();
+  }
+  BOOST_CHECK_EQUAL(reserved, gplib::arena_reserved_bytes());
+
+  gplib::arena_release();
+  BOOST_CHECK_EQUAL(gplib::arena_cached_bytes(), 0);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t reuse [arena] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+#ifdef GPLIB_USE_ARENA
+BOOST_AUTO_TEST_CASE( arena_training ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t N = 40;
+  arma::mat X(N, 1);
+  arma::vec y(N);
+  for (size_t i = 0; i < N; ++i) {
+    X(i, 0) = 0.25 * i;
+    y(i) = sin(X(i, 0));
+  }
+  vector<double> start({1.0, 1.0, 0.1});
+  auto K = make_shared<gplib::kernels::squared_exponential>(start);
+  K-> set_lower_bounds({0.1, 0.1, 0.01});
+  K-> set_upper_bounds({3.0, 3.0, 0.5});
+  gplib::gp_reg reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  reg.set_threads(1);
+
+  // The same run again only uses the blocks cached by the first one.
+  gplib::train_options options;
+  options.max_eval = 20;
+  reg.train(options);
+  size_t reserved = gplib::arena_reserved_bytes();
+  K-> set_params(start);
+  reg.train(options);
+  BOOST_CHECK_EQUAL(reserved, gplib::arena_reserved_bytes());
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t training [arena] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+#include <armadillo>
+#include <vector>
+#include <ctime>
+#include <ratio>
+#include <chrono>
+
+#include "gplib/gplib.hpp"
+
+using namespace std;
+using namespace arma;
+
+BOOST_AUTO_TEST_SUITE( basic )
+
+BOOST_AUTO_TEST_CASE( basic_triangular ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t n = 6;
+  mat A = randn(n, n);
+  mat U = trimatu(A) + n * eye<mat>(n, n);
+  mat L = trimatl(A) + n * eye<mat>(n, n);
+  mat B = randn(n, 3);
+  vec b = randn(n);
+
+  // The other triangle is ignored.
+  mat strict_lower = trimatl(A) - diagmat(A);
+  mat strict_upper = trimatu(A) - diagmat(A);
+  BOOST_CHECK(approx_equal(gplib::triangular_inverse(U + strict_lower),
+        inv(U), "absdiff", 1e-10));
+  BOOST_CHECK(approx_equal(gplib::triangular_inverse(L + strict_upper, false),
+        inv(L), "absdiff", 1e-10));
+
+  // The four combinations of upper and trans.
+  BOOST_CHECK(approx_equal(gplib::triangular_solve(U, B, true, false),
+        solve(U, B), "absdiff", 1e-10));
+  BOOST_CHECK(approx_equal(gplib::triangular_solve(U, B, true, true),
+        solve(mat(U.t()), B), "absdiff", 1e-10));
+  BOOST_CHECK(approx_equal(gplib::triangular_solve(L, B, false, false),
+        solve(L, B), "absdiff", 1e-10));
+  BOOST_CHECK(approx_equal(gplib::triangular_solve(L, B, false, true),
+        solve(mat(L.t()), B), "absdiff", 1e-10));
+  BOOST_CHECK(approx_equal(gplib::triangular_solve(U, b), vec(solve(U, b)),
+        "absdiff", 1e-10));
+
+  mat singular = U;
+  singular(2, 2) = 0;
+  BOOST_CHECK_THROW(gplib::triangular_solve(singular, B), runtime_error);
+  BOOST_CHECK_THROW(gplib::triangular_inverse(singular), runtime_error);
+  BOOST_CHECK_THROW(gplib::triangular_solve(U, mat(n + 1, 2)), length_error);
+
+  // Upper cholesky factor, A = R' * R
+  mat S = A * A.t() + eye<mat>(n, n);
+  mat R = chol(S);
+  BOOST_CHECK(approx_equal(gplib::chol_solve(R, B), solve(S, B), "absdiff",
+        1e-8));
+  BOOST_CHECK_SMALL(gplib::chol_log_det(R) - log(det(S)), 1e-8);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t triangular [basic] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,290 @@
+#include <boost/test/unit_test.hpp>
+#include <armadillo>
+#include <vector>
+#include <ctime>
+#include <ratio>
+#include <chrono>
+
+#include "gplib/gplib.hpp"
+
+using namespace std;
+using namespace arma;
+
+// A user kernel written against the interface without clone.
+class no_clone_kernel : public gplib::kernel_class {
+  gplib::kernels::squared_exponential k;
+public:
+  no_clone_kernel(const vector<double> &params) : k(params) {}
+  mat eval(const mat &X, const mat &Y, bool diag = false) const {
+    return k.eval(X, Y, diag);
+  }
+  mat derivate(size_t param_id, const mat &X, const mat &Y,
+      bool diag = false) const {
+    return k.derivate(param_id, X, Y, diag);
+  }
+  size_t n_params() const { return k.n_params(); }
+  void set_params(const vector<double> &params) { k.set_params(params); }
+  void set_lower_bounds(const vector<double> &lower_bounds) {
+    k.set_lower_bounds(lower_bounds);
+  }
+  void set_upper_bounds(const vector<double> &upper_bounds) {
+    k.set_upper_bounds(upper_bounds);
+  }
+  vector<double> get_params() const { return k.get_params(); }
+  vector<double> get_lower_bounds() const { return k.get_lower_bounds(); }
+  vector<double> get_upper_bounds() const { return k.get_upper_bounds(); }
+};
+
+BOOST_AUTO_TEST_SUITE( gp_reg )
+
+BOOST_AUTO_TEST_CASE( gp_reg_sample_path ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t N = 30;
+  mat X(N, 1);
+  vec y(N);
+  for (size_t i = 0; i < N; ++i) {
+    X(i, 0) = 0.3 * i;
+    y(i) = sin(X(i, 0));
+  }
+  mat new_X = X.rows(0, N - 2) + 0.15;
+
+  auto K = make_shared<gplib::kernels::squared_exponential>(
+      vector<double>({1.0, 1.0, 0.1}));
+  gplib::gp_reg reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  vec expected = reg.predict(new_X);
+
+  // The average of the sampled functions approaches the posterior mean.
+  const size_t n_paths = 200;
+  gplib::rng_stream rng(1234);
+  vec average = zeros<vec>(new_X.n_rows);
+  for (size_t i = 0; i < n_paths; ++i)
+    average += reg.sample_path(500, rng).eval(new_X);
+  average /= n_paths;
+
+  for (size_t i = 0; i < new_X.n_rows; ++i)
+    BOOST_CHECK_SMALL(average(i) - expected(i), 0.1);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t sample_path [gp_reg] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_start ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Both designs put one point in each of the n strata of every dimension
+  // (for Sobol when n is a power of two).
+  const size_t n = 16, dim = 40;
+  gplib::rng_stream design_rng(7);
+  vector<mat> designs({gplib::latin_hypercube(n, dim, design_rng),
+                       gplib::sobol(n, dim, design_rng)});
+  for (size_t k = 0; k < designs.size(); ++k) {
+    for (size_t j = 0; j < dim; ++j) {
+      uvec strata = sort(conv_to<uvec>::from(floor(designs[k].col(j) * n)));
+      for (size_t i = 0; i < n; ++i)
+        BOOST_CHECK_EQUAL(strata(i), i);
+    }
+  }
+
+  const size_t N = 40;
+  mat X(N, 1);
+  vec y(N);
+  for (size_t i = 0; i < N; ++i) {
+    X(i, 0) = 0.25 * i;
+    y(i) = sin(X(i, 0));
+  }
+
+  // The result does not depend on how many starts run at the same time.
+  vector<vector<double>> params;
+  for (size_t n_threads = 1; n_threads <= 4; n_threads += 3) {
+    auto K = make_shared<gplib::kernels::squared_exponential>(
+        vector<double>({1.0, 1.0, 0.1}));
+    K-> set_lower_bounds({0.1, 0.1, 0.01});
+    K-> set_upper_bounds({3.0, 3.0, 0.5});
+    gplib::gp_reg reg;
+    reg.set_kernel(K);
+    reg.set_training_set(X, y);
+    reg.set_threads(n_threads);
+    gplib::rng_stream rng(42);
+    double value = reg.train(50, 1e-4, 6, rng, gplib::SOBOL, 20.0);
+    BOOST_CHECK(std::isfinite(value));
+    params.push_back(K-> get_params());
+  }
+  BOOST_CHECK(params[0] == params[1]);
+
+  // Kernels without clone still train from one start, multi-start reports
+  // the missing copy before training.
+  auto K = make_shared<no_clone_kernel>(vector<double>({1.0, 1.0, 0.1}));
+  K-> set_lower_bounds({0.1, 0.1, 0.01});
+  K-> set_upper_bounds({3.0, 3.0, 0.5});
+  gplib::gp_reg reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  BOOST_CHECK(std::isfinite(reg.train(5, 1e-4)));
+  gplib::rng_stream rng(42);
+  BOOST_CHECK_THROW(reg.train(5, 1e-4, 2, rng), logic_error);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t multi_start [gp_reg] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_train_options ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // The transforms invert each other and the derivative is the one used
+  // by the chain rule.
+  vector<int> transforms({gplib::LOG, gplib::SOFTPLUS});
+  for (size_t k = 0; k < transforms.size(); ++k) {
+    for (double u = -5.0; u <= 5.0; u += 0.5) {
+      int t = transforms[k];
+      double theta = gplib::from_unconstrained(u, t);
+      BOOST_CHECK_SMALL(gplib::to_unconstrained(theta, t) - u, 1e-8);
+      double h = 1e-6;
+      double numeric = (gplib::from_unconstrained(u + h, t) -
+                        gplib::from_unconstrained(u - h, t)) / (2 * h);
+      BOOST_CHECK_SMALL(gplib::transform_derivative(u, t) - numeric, 1e-6);
+    }
+  }
+
+  const size_t N = 40;
+  mat X(N, 1);
+  vec y(N);
+  for (size_t i = 0; i < N; ++i) {
+    X(i, 0) = 0.25 * i;
+    y(i) = sin(X(i, 0));
+  }
+
+  // L-BFGS on the log of the parameters, inside the bounds.
+  vector<double> lb({0.01, 0.01, 0.001}), ub({10.0, 10.0, 1.0});
+  auto K = make_shared<gplib::kernels::squared_exponential>(
+      vector<double>({1.0, 1.0, 0.1}));
+  K-> set_lower_bounds(lb);
+  K-> set_upper_bounds(ub);
+  gplib::gp_reg reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+
+  gplib::train_options options;
+  options.algorithm = gplib::LBFGS;
+  options.transforms.assign(3, gplib::LOG);
+  options.max_eval = 50;
+  options.max_time = 10.0;
+  double value = reg.train(options);
+  BOOST_CHECK(std::isfinite(value));
+  vector<double> params = K-> get_params();
+  for (size_t i = 0; i < params.size(); ++i) {
+    BOOST_CHECK(params[i] >= lb[i] * (1 - 1e-12));
+    BOOST_CHECK(params[i] <= ub[i] * (1 + 1e-12));
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t train_options [gp_reg] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_add_observations ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t N = 60, window = 30, step = 4;
+  mat X(N, 2, fill::randn);
+  vec y = sin(X.col(0)) + cos(X.col(1));
+  mat new_X(10, 2, fill::randn);
+
+  auto K = make_shared<gplib::kernels::squared_exponential>(
+      vector<double>({1.0, 1.5, 0.1}));
+
+  // Streaming with a sliding window, the factor is only updated.
+  gplib::gp_reg stream;
+  stream.set_kernel(K);
+  stream.set_training_set(X.rows(0, step - 1), y.subvec(0, step - 1));
+  stream.set_window(window);
+  stream.predict(new_X);
+  for (size_t first = step; first < N; first += step)
+    stream.add_observations(X.rows(first, first + step - 1),
+        y.subvec(first, first + step - 1));
+
+  // Same predictions as training from scratch on the last window rows.
+  gplib::gp_reg batch;
+  batch.set_kernel(K);
+  batch.set_training_set(X.rows(N - window, N - 1), y.subvec(N - window, N - 1));
+  gplib::mv_gauss a = stream.full_predict(new_X);
+  gplib::mv_gauss b = batch.full_predict(new_X);
+  BOOST_CHECK(approx_equal(a.get_mean(), b.get_mean(), "absdiff", 1e-8));
+  BOOST_CHECK(approx_equal(a.get_cov(), b.get_cov(), "absdiff", 1e-8));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t add_observations [gp_reg] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_concurrent_predict ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t N = 60, n_calls = 8;
+  mat X(N, 2, fill::randn);
+  vec y = sin(X.col(0)) + cos(X.col(1));
+  mat new_X(10, 2, fill::randn);
+  auto K = make_shared<gplib::kernels::squared_exponential>(
+      vector<double>({1.0, 1.5, 0.1}));
+
+  // The first calls race to build the cached factor.
+  gplib::gp_reg shared;
+  shared.set_kernel(K);
+  shared.set_training_set(X, y);
+  vector<vec> means(n_calls);
+  gplib::parallel_for(0, n_calls, [&](size_t k) {
+    means[k] = shared.predict(new_X);
+  }, 4);
+
+  gplib::gp_reg serial;
+  serial.set_kernel(K);
+  serial.set_training_set(X, y);
+  vec expected = serial.predict(new_X);
+  for (size_t k = 0; k < n_calls; ++k)
+    BOOST_CHECK(approx_equal(means[k], expected, "absdiff", 1e-12));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t concurrent_predict [gp_reg] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_SUITE_END()
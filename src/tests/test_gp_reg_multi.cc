@@ -14,6 +14,60 @@ const double m_pi = acos(-1);
 using namespace std;
 using namespace arma;
 
+// Compares the gradient of the training objective with central differences
+// for every parameter that train moves, and restores the parameters.
+void check_objective_gradient(gplib::gp_reg_multi &reg) {
+  vector<double> theta = reg.get_all_params(), grad;
+  reg.objective(grad);
+  BOOST_CHECK_EQUAL(grad.size(), theta.size());
+  for (size_t d = 0; d < theta.size(); ++d) {
+    double h = 1e-5 * std::max(1.0, fabs(theta[d]));
+    vector<double> t = theta;
+    t[d] = theta[d] + h;
+    reg.set_params(t);
+    double f_plus = reg.objective();
+    t[d] = theta[d] - h;
+    reg.set_params(t);
+    double f_minus = reg.objective();
+    double numeric = (f_plus - f_minus) / (2.0 * h);
+    BOOST_CHECK_SMALL(grad[d] - numeric, 1e-4 * (1.0 + fabs(numeric)));
+  }
+  reg.set_params(theta);
+}
+
+// Sparse model with two latent functions of rank one, whose parameter
+// matrices have exact derivatives, at fixed parameters and pseudo-inputs.
+void set_sparse_model(gplib::gp_reg_multi &reg, double sigma) {
+  const size_t noutputs = 2, N = 15;
+  vector<mat> X(noutputs, mat(N, 1));
+  vector<vec> y(noutputs, vec(N));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < N; ++r) {
+      X[i](r, 0) = 0.5 * r + 0.1 * i;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+  }
+  vector<mat> pi({linspace<mat>(1.0, 6.0, 4), linspace<mat>(0.5, 5.5, 3)});
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(2, noutputs);
+  K-> set_rank(1);
+  vector<double> kernel_params({0.8, 0.5, 0.2, 0.3, 0.4, -0.6, 0.1, 0.2,
+                                1.0, 1.5, 0.1, 0.7, 0.8, 0.05});
+  K-> set_params(kernel_params);
+  K-> set_lower_bounds(-5.0);
+  K-> set_upper_bounds(5.0);
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  reg.train(1, 1e-4, pi, true);
+
+  // Back to the chosen point, whatever the single step did
+  vector<double> theta = kernel_params;
+  for (size_t i = 0; i < pi.size(); ++i)
+    theta.insert(theta.end(), pi[i].begin(), pi[i].end());
+  theta.push_back(sigma);
+  reg.set_params(theta);
+}
+
 BOOST_AUTO_TEST_SUITE( gp_reg_multi )
 
 BOOST_AUTO_TEST_CASE( gp_reg_multi_get_set ) {
@@ -258,4 +312,502 @@ BOOST_AUTO_TEST_CASE( gp_reg_multi_opt ) {
 
 
 
+BOOST_AUTO_TEST_CASE( mo_dataset_views ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  vector<mat> X({randn<mat>(5, 3), randn<mat>(0, 3), randn<mat>(7, 3)});
+  vector<vec> y({randn<vec>(5), vec(), randn<vec>(7)});
+  gplib::mo_dataset data(X, y);
+  gplib::mo_dataset copy = data;
+
+  BOOST_CHECK_EQUAL(copy.n_outputs(), 3u);
+  BOOST_CHECK_EQUAL(copy.n_rows(), 12u);
+  BOOST_CHECK_EQUAL(copy.offset(2), 5u);
+  // The views point inside the buffers of the object.
+  BOOST_CHECK(copy.X()[2].memptr() == copy.X()[0].memptr() + 5 * 3);
+  BOOST_CHECK(copy.y()[2].memptr() == copy.flat_y().memptr() + 5);
+
+  for (size_t i = 0; i < X.size(); ++i) {
+    for (size_t r = 0; r < X[i].n_rows; ++r) {
+      BOOST_CHECK_EQUAL(copy.y()[i](r), y[i](r));
+      BOOST_CHECK_EQUAL(copy.flat_y()(copy.offset(i) + r), y[i](r));
+      for (size_t c = 0; c < X[i].n_cols; ++c)
+        BOOST_CHECK_EQUAL(copy.X()[i](r, c), X[i](r, c));
+    }
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t mo_dataset views passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_retrain ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Appending gives the same dataset as setting everything at once.
+  vector<mat> X_old({randn<mat>(4, 2), randn<mat>(3, 2)});
+  vector<vec> y_old({randn<vec>(4), randn<vec>(3)});
+  vector<mat> X_new({randn<mat>(2, 2), randn<mat>(0, 2)});
+  vector<vec> y_new({randn<vec>(2), vec()});
+  gplib::mo_dataset data(X_old, y_old);
+  data.append(X_new, y_new);
+  vector<mat> X_all({join_vert(X_old[0], X_new[0]), X_old[1]});
+  vector<vec> y_all({join_vert(y_old[0], y_new[0]), y_old[1]});
+  gplib::mo_dataset expected(X_all, y_all);
+  BOOST_CHECK_EQUAL(data.n_rows(), expected.n_rows());
+  BOOST_CHECK(approx_equal(data.flat_y(), expected.flat_y(), "absdiff", 0));
+  for (size_t i = 0; i < X_all.size(); ++i)
+    BOOST_CHECK(approx_equal(data.X()[i], X_all[i], "absdiff", 0));
+
+  // Retraining keeps the pseudo-inputs of the first training.
+  const size_t noutputs = 2, MN = 40;
+  vector<mat> X(noutputs, mat(MN, 1)), X_more(noutputs, mat(5, 1));
+  vector<vec> y(noutputs, vec(MN)), y_more(noutputs, vec(5));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.5 * r;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+    for (size_t r = 0; r < 5; ++r) {
+      X_more[i](r, 0) = 0.5 * r + 0.25;
+      y_more[i](r) = sin(X_more[i](r, 0) + i);
+    }
+  }
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  K-> set_lower_bounds(0.01);
+  K-> set_upper_bounds(5.0);
+  gplib::gp_reg_multi reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  reg.train(20, 1e-4, vector<size_t>(noutputs, 10));
+  size_t n_params = reg.get_all_params().size();
+  double value = reg.retrain(X_more, y_more, 5);
+  BOOST_CHECK(std::isfinite(value));
+  BOOST_CHECK_EQUAL(reg.get_all_params().size(), n_params);
+  vec mean = reg.predict(X_more);
+  BOOST_CHECK_EQUAL(mean.n_elem, 10u);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t retrain [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_retrain_cache ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 2, MN = 30;
+  vector<size_t> more({5, 2});
+  vector<mat> X(noutputs, mat(MN, 1)), X_more(noutputs);
+  vector<vec> y(noutputs, vec(MN)), y_more(noutputs);
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.3 * r;
+      y[i](r) = cos(X[i](r, 0) - i);
+    }
+    X_more[i] = linspace<mat>(0.2, 7.0, more[i]);
+    y_more[i] = cos(X_more[i].col(0) - i);
+  }
+  vector<mat> new_X(noutputs, linspace<mat>(0.1, 8.0, 7));
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  K-> set_params({1.0, 0.0, 0.5, 0.8, 1.0, 1.5, 0.1});
+  K-> set_lower_bounds(0.0);
+  K-> set_upper_bounds(5.0);
+  gplib::gp_reg_multi reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  reg.train(10, 1e-4, vector<size_t>(noutputs, 8));
+
+  // The cached Kuf, V and Kff_diag match the current parameters, so the
+  // retraining only evaluates the new rows and appends them.
+  reg.objective();
+  reg.retrain(X_more, y_more, 1);
+
+  vector<mat> X_all(noutputs);
+  vector<vec> y_all(noutputs);
+  for (size_t i = 0; i < noutputs; ++i) {
+    X_all[i] = join_vert(X[i], X_more[i]);
+    y_all[i] = join_vert(y[i], y_more[i]);
+  }
+  gplib::gp_reg_multi scratch;
+  scratch.set_kernel(K-> clone());
+  scratch.set_training_set(X_all, y_all);
+  scratch.train(1, 1e-4, vector<size_t>(noutputs, 8));
+  scratch.set_params(reg.get_all_params());
+
+  // Same objective, gradient and predictions as computing everything again
+  vector<double> grad, expected;
+  double value = reg.objective(grad);
+  BOOST_CHECK_SMALL(value - scratch.objective(expected), 1e-8);
+  BOOST_CHECK_EQUAL(grad.size(), expected.size());
+  for (size_t d = 0; d < grad.size() && d < expected.size(); ++d)
+    BOOST_CHECK_SMALL(grad[d] - expected[d], 1e-8);
+  BOOST_CHECK(approx_equal(reg.predict(new_X), scratch.predict(new_X),
+        "absdiff", 1e-8));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t retrain_cache [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_retrain_predict ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 2, MN = 30, more = 6;
+  vector<mat> X(noutputs, mat(MN, 1)), X_more(noutputs, mat(more, 1));
+  vector<vec> y(noutputs, vec(MN)), y_more(noutputs, vec(more));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.3 * r;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+    for (size_t r = 0; r < more; ++r) {
+      X_more[i](r, 0) = 0.3 * r + 0.15;
+      y_more[i](r) = sin(X_more[i](r, 0) + i) + 0.5;
+    }
+  }
+  vector<mat> new_X(noutputs, linspace<mat>(0.1, 8.0, 7));
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  K-> set_params({1.0, 0.0, 0.5, 0.8, 1.0, 1.5, 0.1});
+  K-> set_lower_bounds(0.0);
+  K-> set_upper_bounds(5.0);
+  gplib::gp_reg_multi reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  reg.train(10, 1e-4, vector<size_t>(noutputs, 8));
+  reg.predict(new_X);
+
+  // A single evaluation leaves the parameters where they were, the
+  // predictor must still see the new rows.
+  reg.retrain(X_more, y_more, 1);
+
+  vector<mat> X_all(noutputs);
+  vector<vec> y_all(noutputs);
+  for (size_t i = 0; i < noutputs; ++i) {
+    X_all[i] = join_vert(X[i], X_more[i]);
+    y_all[i] = join_vert(y[i], y_more[i]);
+  }
+  gplib::gp_reg_multi scratch;
+  scratch.set_kernel(K-> clone());
+  scratch.set_training_set(X_all, y_all);
+  scratch.train(1, 1e-4, vector<size_t>(noutputs, 8));
+  scratch.set_params(reg.get_all_params());
+  BOOST_CHECK(approx_equal(reg.predict(new_X), scratch.predict(new_X),
+        "absdiff", 1e-8));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t retrain_predict [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_stream_update ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 2, MN = 40, B = 8;
+  vector<mat> X(noutputs, mat(MN, 1)), X_batch(noutputs, mat(B, 1));
+  vector<vec> y(noutputs, vec(MN)), y_batch(noutputs, vec(B));
+  vector<mat> new_X(noutputs, linspace<mat>(0.1, 15.0, 7));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.4 * r;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+    for (size_t r = 0; r < B; ++r) {
+      X_batch[i](r, 0) = 0.4 * r + 0.2;
+      y_batch[i](r) = sin(X_batch[i](r, 0) + i);
+    }
+  }
+  vector<mat> pi(noutputs, linspace<mat>(0.5, 15.0, 8));
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  gplib::gp_reg_multi stream;
+  stream.set_kernel(K);
+  stream.set_training_set(X, y);
+  stream.train(5, 1e-4, pi);
+  stream.stream_update(X_batch, y_batch);
+
+  // The streamed predictor matches FITC on all the rows with the same
+  // parameters and inducing points.
+  vector<mat> X_all(noutputs);
+  vector<vec> y_all(noutputs);
+  for (size_t i = 0; i < noutputs; ++i) {
+    X_all[i] = join_vert(X[i], X_batch[i]);
+    y_all[i] = join_vert(y[i], y_batch[i]);
+  }
+  gplib::gp_reg_multi batch;
+  batch.set_kernel(K-> clone());
+  batch.set_training_set(X_all, y_all);
+  batch.train(1, 1e-4, pi);
+  batch.set_params(stream.get_all_params());
+  vec a = stream.predict(new_X), b = batch.predict(new_X);
+  BOOST_CHECK(approx_equal(a, b, "absdiff", 1e-8));
+
+  // Refreshing with the same inducing points keeps the predictor.
+  stream.refresh_inducing_points(pi);
+  BOOST_CHECK(approx_equal(stream.predict(new_X), a, "absdiff", 1e-6));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t stream_update [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_inducing_init ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Three well separated clusters, k-means++ puts one center in each and
+  // the result does not depend on the number of threads.
+  const size_t per_cluster = 1500;
+  mat centers = {{0.0, 0.0}, {10.0, 0.0}, {0.0, 10.0}};
+  mat points(3 * per_cluster, 2);
+  gplib::rng_stream noise(3);
+  for (size_t c = 0; c < 3; ++c) {
+    mat cluster = 0.1 * noise.randn(per_cluster, 2);
+    cluster.each_row() += centers.row(c);
+    points.rows(c * per_cluster, (c + 1) * per_cluster - 1) = cluster;
+  }
+  gplib::rng_stream rng_a(11), rng_b(11);
+  mat a = gplib::kmeans_points(points, 3, rng_a, 10, 1);
+  mat b = gplib::kmeans_points(points, 3, rng_b, 10, 4);
+  BOOST_CHECK(approx_equal(a, b, "absdiff", 1e-12));
+  for (size_t c = 0; c < 3; ++c) {
+    rowvec dist = sum(square(a.each_row() - centers.row(c)), 1).t();
+    BOOST_CHECK_SMALL(dist.min(), 0.01);
+  }
+
+  // The pivoted Cholesky points are distinct inputs.
+  const size_t noutputs = 2, MN = 60, n_pi = 8;
+  vector<mat> X(noutputs, mat(MN, 1));
+  vector<vec> y(noutputs, vec(MN));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.25 * r;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+  }
+  vector<int> inits({gplib::KMEANS, gplib::PIVOTED_CHOLESKY});
+  for (size_t k = 0; k < inits.size(); ++k) {
+    auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+    gplib::gp_reg_multi reg;
+    reg.set_kernel(K);
+    reg.set_training_set(X, y);
+    gplib::train_options options = reg.get_train_options();
+    options.inducing_init = inits[k];
+    reg.set_train_options(options);
+    double value = reg.train(5, 1e-4, n_pi);
+    BOOST_CHECK(std::isfinite(value));
+  }
+  auto SE = make_shared<gplib::kernels::squared_exponential>(
+      vector<double>({1.0, 1.0, 0.0}));
+  mat col_X = X[0];
+  vec diag(MN);
+  for (size_t r = 0; r < MN; ++r)
+    diag(r) = SE-> eval(col_X.row(r), col_X.row(r))(0, 0);
+  mat P = gplib::pivoted_cholesky_points(col_X, n_pi, diag, [&](size_t j) {
+        return vec(SE-> eval(col_X, col_X.row(j)).col(0));
+      });
+  BOOST_CHECK_EQUAL(P.n_rows, n_pi);
+  vec distinct = unique(P.col(0));
+  BOOST_CHECK_EQUAL(distinct.n_elem, n_pi);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t inducing_init [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_fitc_gradient ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Parameter matrices, inner kernels, pseudo-inputs and sigma.
+  gplib::gp_reg_multi reg;
+  set_sparse_model(reg, 0.05);
+  check_objective_gradient(reg);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t fitc_gradient [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_vfe_gradient ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Same model under the variational bound, the trace term also depends on
+  // sigma.
+  gplib::gp_reg_multi reg;
+  reg.set_sparse_mode(gplib::gp_reg_multi::VFE);
+  set_sparse_model(reg, 0.05);
+  check_objective_gradient(reg);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t vfe_gradient [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_vfe ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 2, MN = 50;
+  vector<mat> X(noutputs, mat(MN, 1));
+  vector<vec> y(noutputs, vec(MN));
+  vector<mat> new_X(noutputs, linspace<mat>(0.3, 11.0, 9));
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t r = 0; r < MN; ++r) {
+      X[i](r, 0) = 0.25 * r;
+      y[i](r) = sin(X[i](r, 0) + i);
+    }
+  }
+  vector<mat> pi(noutputs, linspace<mat>(0.5, 12.0, 12));
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  gplib::gp_reg_multi reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  BOOST_CHECK_THROW(reg.set_sparse_mode(gplib::gp_reg_multi::FULL),
+      logic_error);
+  reg.set_sparse_mode(gplib::gp_reg_multi::VFE);
+  double value = reg.train(30, 1e-4, pi);
+  BOOST_CHECK(std::isfinite(value));
+
+  vec mean = reg.predict(new_X);
+  for (size_t i = 0; i < noutputs; ++i)
+    for (size_t r = 0; r < new_X[i].n_rows; ++r)
+      BOOST_CHECK_SMALL(mean(i * new_X[i].n_rows + r) -
+          sin(new_X[i](r, 0) + i), 0.1);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t vfe [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( gp_reg_multi_icm ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3, N = 40;
+  mat X0 = linspace<mat>(0.0, 8.0, N);
+  vector<mat> X(noutputs, X0);
+  vector<vec> y(noutputs);
+  for (size_t i = 0; i < noutputs; ++i)
+    y[i] = sin(X0.col(0) + 0.5 * i);
+  vector<mat> new_X({linspace<mat>(0.1, 7.9, 5), linspace<mat>(0.2, 7.0, 4),
+                     linspace<mat>(1.0, 3.0, 3)});
+
+  auto K = make_shared<gplib::multioutput_kernels::lmc_kernel>(1, noutputs);
+  K-> set_params({1.0, 0.0, 0.0, 0.6, 0.8, 0.0, -0.3, 0.2, 0.9,
+                  1.0, 1.2, 0.1});
+
+  // The two reductions of W give the same contraction as the blocks.
+  mat W = randn<mat>(N * noutputs, N * noutputs);
+  W = W + W.t();
+  mat B = K-> get_params_k()[0];
+  mat Kx = K-> get_kernels()[0]-> eval(X0, X0);
+  mat G_B(noutputs, noutputs), W_K = zeros<mat>(N, N);
+  for (size_t i = 0; i < noutputs; ++i) {
+    for (size_t j = 0; j < noutputs; ++j) {
+      mat W_ij = W.submat(i * N, j * N, (i + 1) * N - 1, (j + 1) * N - 1);
+      G_B(i, j) = accu(W_ij % Kx);
+      W_K += B(i, j) * W_ij;
+    }
+  }
+  vector<double> blocks = K-> contract(W, X, X);
+  vector<double> icm = K-> contract_icm(G_B, W_K, X0);
+  BOOST_CHECK_EQUAL(blocks.size(), icm.size());
+  for (size_t d = 0; d < blocks.size(); ++d)
+    BOOST_CHECK_SMALL(blocks[d] - icm[d], 1e-8 * (1 + fabs(blocks[d])));
+
+  // Same posterior as conditioning the joint Gaussian of all the outputs.
+  gplib::gp_reg_multi reg;
+  reg.set_kernel(K);
+  reg.set_training_set(X, y);
+  gplib::mv_gauss fast = reg.full_predict(new_X);
+
+  vector<mat> joint(noutputs);
+  vec fill_y = zeros<vec>(N * noutputs + 12);
+  vector<bool> observed(fill_y.n_elem, false);
+  size_t start = 0;
+  for (size_t i = 0; i < noutputs; ++i) {
+    joint[i] = join_vert(X0, new_X[i]);
+    fill_y.subvec(start, start + N - 1) = y[i];
+    fill(observed.begin() + start, observed.begin() + start + N, true);
+    start += joint[i].n_rows;
+  }
+  gplib::mv_gauss prior(zeros<vec>(fill_y.n_elem), K-> eval(joint, joint));
+  gplib::mv_gauss exact = prior.conditional(fill_y, observed);
+  BOOST_CHECK(approx_equal(fast.get_mean(), exact.get_mean(), "absdiff", 1e-6));
+  BOOST_CHECK(approx_equal(fast.get_cov(), exact.get_cov(), "absdiff", 1e-6));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t icm [gp_reg_multi] passed in "
+    << time_span.count() << " seconds. \033[0m\n";
+}
+
 BOOST_AUTO_TEST_SUITE_END()
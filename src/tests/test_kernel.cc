@@ -190,4 +190,68 @@ BOOST_AUTO_TEST_CASE( gradiend_wrt_dta ) {
        << time_span.count() << " seconds. \033[0m\n";
 }
 
+BOOST_AUTO_TEST_CASE( compact_gradient_wrt_inputs ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  gplib::kernels::squared_exponential test(std::vector<double>({0.9, 1.2, 0.1}));
+  arma::mat X = arma::randn(7, 2);
+  arma::mat Z = arma::randn(3, 2);
+
+  // The compact form holds the non zero column of each derivate matrix.
+  arma::cube fast = test.derivate_wrt_inputs(X, Z);
+  arma::cube slow = test.gplib::kernel_class::derivate_wrt_inputs(X, Z);
+  BOOST_CHECK_EQUAL(fast.n_rows, X.n_rows);
+  BOOST_CHECK_EQUAL(fast.n_cols, Z.n_rows);
+  BOOST_CHECK_EQUAL(fast.n_slices, Z.n_cols);
+  for (size_t i = 0; i < fast.n_elem; ++i)
+    BOOST_CHECK_SMALL(fast(i) - slow(i), 1e-10);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t compact gradient wrt inputs kernel passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( eval_from_distances ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  gplib::kernels::squared_exponential test(std::vector<double>({0.9, 1.2, 0.1}));
+  arma::mat X = arma::randn(7, 2);
+  arma::mat Y = arma::randn(5, 2);
+  arma::mat W = arma::randn(7, 5);
+  arma::mat d2(X.n_rows, Y.n_rows);
+  for (size_t i = 0; i < X.n_rows; ++i)
+    for (size_t j = 0; j < Y.n_rows; ++j)
+      d2(i, j) = arma::accu(arma::square(X.row(i) - Y.row(j)));
+
+  // Same values as from the inputs, the noise term keeps its shape.
+  BOOST_CHECK(test.isotropic());
+  BOOST_CHECK(arma::approx_equal(test.eval_distances(d2), test.eval(X, Y),
+        "absdiff", 1e-12));
+  for (size_t p = 0; p < test.n_params(); ++p)
+    BOOST_CHECK(arma::approx_equal(test.derivate_distances(p, d2),
+          test.derivate(p, X, Y), "absdiff", 1e-12));
+  std::vector<double> fast = test.contract_distances(W, d2);
+  std::vector<double> slow = test.contract(W, X, Y);
+  for (size_t p = 0; p < fast.size(); ++p)
+    BOOST_CHECK_SMALL(fast[p] - slow[p], 1e-10);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t eval from distances kernel passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
 BOOST_AUTO_TEST_SUITE_END()
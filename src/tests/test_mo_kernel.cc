@@ -1,6 +1,7 @@
 #include <boost/test/unit_test.hpp>
 #include <armadillo>
 #include <vector>
+#include <atomic>
 #include <ctime>
 #include <ratio>
 #include <chrono>
@@ -11,6 +12,43 @@ const double eps = 1e-5;
 
 using namespace std;
 
+// Hides isotropic() of the wrapped kernel, so lmc_kernel evaluates it from
+// the inputs instead of the shared squared distances. It also counts the
+// evaluations.
+class opaque_kernel : public gplib::kernel_class {
+  shared_ptr<gplib::kernel_class> k;
+public:
+  mutable atomic<size_t> evals;
+  opaque_kernel(const shared_ptr<gplib::kernel_class> &k) : k(k), evals(0) {}
+  arma::mat eval(const arma::mat &X, const arma::mat &Y,
+      bool diag = false) const {
+    ++evals;
+    return k-> eval(X, Y, diag);
+  }
+  arma::mat derivate(size_t param_id, const arma::mat &X, const arma::mat &Y,
+      bool diag = false) const {
+    return k-> derivate(param_id, X, Y, diag);
+  }
+  vector<double> contract(const arma::mat &W, const arma::mat &X,
+      const arma::mat &Y, bool diag = false, size_t n_threads = 0) const {
+    return k-> contract(W, X, Y, diag, n_threads);
+  }
+  size_t n_params() const { return k-> n_params(); }
+  void set_params(const vector<double> &params) { k-> set_params(params); }
+  void set_lower_bounds(const vector<double> &lower_bounds) {
+    k-> set_lower_bounds(lower_bounds);
+  }
+  void set_upper_bounds(const vector<double> &upper_bounds) {
+    k-> set_upper_bounds(upper_bounds);
+  }
+  vector<double> get_params() const { return k-> get_params(); }
+  vector<double> get_lower_bounds() const { return k-> get_lower_bounds(); }
+  vector<double> get_upper_bounds() const { return k-> get_upper_bounds(); }
+  shared_ptr<gplib::kernel_class> clone() const {
+    return make_shared<opaque_kernel>(k-> clone());
+  }
+};
+
 BOOST_AUTO_TEST_SUITE( mo_kernels )
 
 
@@ -110,6 +148,93 @@ BOOST_AUTO_TEST_CASE( mo_eval_lmc_kernel ) {
   cout << "\033[32m\t eval [multioutput lmc_kernel] passed in "
        << time_span.count() << " seconds. \033[0m\n";
 }
+BOOST_AUTO_TEST_CASE( mo_eval_blocks_lmc_kernel ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  vector<arma::mat> X;
+  const int noutputs = 3;
+  for (int i = 0; i < noutputs; ++i)
+    X.push_back(arma::randn(20 + 5 * i, 2));
+
+  vector<shared_ptr<gplib::kernel_class>> latent_functions;
+  latent_functions.push_back(
+      make_shared<gplib::kernels::squared_exponential>(
+        vector<double>({0.9, 1.2, 0.1})));
+  latent_functions.push_back(
+      make_shared<gplib::kernels::squared_exponential>(
+        vector<double>({0.5, 0.4, 0.05})));
+  vector<arma::mat> params(latent_functions.size());
+  for (size_t q = 0; q < params.size(); ++q)
+    params[q] = arma::randu<arma::mat>(noutputs, noutputs);
+
+  gplib::multioutput_kernels::lmc_kernel K(latent_functions, params);
+  arma::mat ans = K.eval(X, X);
+
+  // The mirrored blocks of eval(X, X) match the ones of a separate copy.
+  vector<arma::mat> X_copy = X;
+  BOOST_CHECK(arma::approx_equal(ans, K.eval(X, X_copy), "absdiff", 1e-12));
+
+  // The blocks are written by their own tasks, the thread count does not
+  // change the result.
+  BOOST_CHECK(arma::approx_equal(ans, K.eval(X, X, false, 1), "absdiff",
+        0.0));
+  BOOST_CHECK(arma::approx_equal(ans, K.eval(X, X, false, 4), "absdiff",
+        0.0));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t eval_blocks [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+BOOST_AUTO_TEST_CASE( mo_eval_equal_inputs_lmc_kernel ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X;
+  for (size_t i = 0; i < noutputs; ++i)
+    X.push_back(arma::randn(10 + i, 2));
+  auto inner = make_shared<opaque_kernel>(
+      make_shared<gplib::kernels::squared_exponential>(
+        vector<double>({0.9, 1.2, 0.1})));
+  vector<shared_ptr<gplib::kernel_class>> latent_functions({inner});
+  vector<arma::mat> params({arma::randu<arma::mat>(noutputs, noutputs)});
+  gplib::multioutput_kernels::lmc_kernel K(latent_functions, params);
+
+  // Equal but distinct inputs are detected by value, only the blocks with
+  // i <= j are evaluated.
+  vector<arma::mat> X_copy = X;
+  arma::mat ans = K.eval(X, X_copy);
+  BOOST_CHECK_EQUAL(inner-> evals.load(), noutputs * (noutputs + 1) / 2);
+  inner-> evals = 0;
+  BOOST_CHECK(arma::approx_equal(ans, K.eval(X, X), "absdiff", 0.0));
+  BOOST_CHECK_EQUAL(inner-> evals.load(), noutputs * (noutputs + 1) / 2);
+
+  // A single different entry evaluates every block.
+  X_copy[1](0, 0) += 1.0;
+  inner-> evals = 0;
+  arma::mat other = K.eval(X, X_copy);
+  BOOST_CHECK_EQUAL(inner-> evals.load(), noutputs * noutputs);
+  size_t n0 = X[0].n_rows;
+  BOOST_CHECK(arma::approx_equal(other.submat(0, 0, n0 - 1, n0 - 1),
+        ans.submat(0, 0, n0 - 1, n0 - 1), "absdiff", 0.0));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t eval_equal_inputs [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
 BOOST_AUTO_TEST_CASE( mo_eval_diag_lmc_kernel ) {
   /**
    * The evaluation of kernel must be a positive, semidefinite matrix.
@@ -376,4 +501,260 @@ BOOST_AUTO_TEST_CASE( mo_kernel_diag_deriv ) {
   cout << "\033[32m\t diagonal derivative [multioutput lmc_kernel] passed in " << time_span.count() << " seconds. \033[0m\n";
 }
 
+BOOST_AUTO_TEST_CASE( mo_lmc_contract ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X, Y;
+  for (size_t i = 0; i < noutputs; ++i) {
+    X.push_back(arma::randn(20 + i, 2));
+    Y.push_back(arma::randn(5, 2));
+  }
+
+  vector<shared_ptr<gplib::kernel_class>> latent_functions;
+  vector<arma::mat> params;
+  for (size_t i = 0; i < 2; ++i) {
+    latent_functions.push_back(make_shared<gplib::kernels::squared_exponential>(
+          vector<double>({0.9 + i, 1.2, 0.1})));
+    arma::mat A = arma::randn(noutputs, noutputs);
+    params.push_back(A * A.t() + arma::eye<arma::mat>(noutputs, noutputs));
+  }
+  gplib::multioutput_kernels::lmc_kernel K(latent_functions, params);
+
+  // Same values as contracting each derivative matrix.
+  arma::mat W = arma::randn(K.eval(X, Y).n_rows, K.eval(X, Y).n_cols);
+  vector<double> fused = K.contract(W, X, Y);
+  BOOST_CHECK_EQUAL(fused.size(), K.n_params());
+  for (size_t d = 0; d < K.n_params(); ++d)
+    BOOST_CHECK_SMALL(fused[d] - arma::accu(W % K.derivate(d, X, Y)), 1e-8);
+
+  // With diag only the diagonal weights are given.
+  arma::vec W_diag = arma::randn(K.eval(X, X).n_rows);
+  fused = K.contract(W_diag, X, X, true);
+  for (size_t d = 0; d < K.n_params(); ++d)
+    BOOST_CHECK_SMALL(fused[d] -
+        arma::dot(W_diag, K.derivate(d, X, X, true).diag()), 1e-8);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t contract [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mo_lmc_compact_gradient_wrt_inputs ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X, Z;
+  for (size_t i = 0; i < noutputs; ++i) {
+    X.push_back(arma::randn(10, 2));
+    Z.push_back(arma::randn(3 + i, 2));
+  }
+
+  gplib::multioutput_kernels::lmc_kernel K(2, noutputs);
+  arma::cube fast = K.derivate_wrt_inputs(X, Z);
+  arma::cube slow = K.gplib::multioutput_kernel_class::derivate_wrt_inputs(X, Z);
+  BOOST_CHECK_EQUAL(fast.n_slices, 2);
+  for (size_t i = 0; i < fast.n_elem; ++i)
+    BOOST_CHECK_SMALL(fast(i) - slow(i), 1e-10);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t compact gradient wrt inputs [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mo_lmc_contract_threads ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X;
+  for (size_t i = 0; i < noutputs; ++i)
+    X.push_back(arma::randn(300 + 10 * i, 2));
+
+  gplib::multioutput_kernels::lmc_kernel K(3, noutputs);
+  arma::mat W = arma::randn(K.eval(X, X).n_rows, K.eval(X, X).n_cols);
+
+  // The partial sums are reduced in a fixed order, so the result is the
+  // same bit for bit whatever the number of threads.
+  vector<double> serial = K.contract(W, X, X, false, 1);
+  vector<double> threaded = K.contract(W, X, X, false, 4);
+  BOOST_CHECK(serial == threaded);
+
+  // A single block gives the threads to the tiles of the inner kernel.
+  vector<arma::mat> X_one(1, arma::randn(1000, 2));
+  gplib::multioutput_kernels::lmc_kernel K_one(1, 1);
+  arma::mat W_one = arma::randn(1000, 1000);
+  BOOST_CHECK(K_one.contract(W_one, X_one, X_one, false, 1) ==
+              K_one.contract(W_one, X_one, X_one, false, 4));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t contract threads [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mo_lmc_low_rank ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 4, rank = 2;
+  vector<arma::mat> X, Y;
+  for (size_t i = 0; i < noutputs; ++i) {
+    X.push_back(arma::randn(6 + i, 2));
+    Y.push_back(arma::randn(4, 2));
+  }
+
+  gplib::multioutput_kernels::lmc_kernel K(2, noutputs);
+  K.set_rank(rank);
+  BOOST_CHECK_EQUAL(K.n_params(), 2 * (noutputs * rank + noutputs) + 2 * 3);
+  vector<double> params = K.get_params();
+  for (size_t d = 0; d < params.size(); ++d)
+    params[d] = 0.5 + 0.1 * d;
+  K.set_params(params);
+
+  // Analytic derivatives against central differences of eval.
+  double h = 1e-6;
+  size_t n_coreg = 2 * (noutputs * rank + noutputs);
+  for (size_t d = 0; d < n_coreg; ++d) {
+    vector<double> p = params;
+    p[d] += h;
+    K.set_params(p);
+    arma::mat plus = K.eval(X, Y);
+    p[d] -= 2 * h;
+    K.set_params(p);
+    arma::mat minus = K.eval(X, Y);
+    K.set_params(params);
+    arma::mat numeric = (plus - minus) / (2 * h);
+    BOOST_CHECK(arma::approx_equal(K.derivate(d, X, Y), numeric, "absdiff",
+          1e-6));
+  }
+
+  arma::mat W = arma::randn(K.eval(X, Y).n_rows, K.eval(X, Y).n_cols);
+  vector<double> fused = K.contract(W, X, Y);
+  for (size_t d = 0; d < K.n_params(); ++d)
+    BOOST_CHECK_SMALL(fused[d] - arma::accu(W % K.derivate(d, X, Y)), 1e-8);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t low rank [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mo_lmc_derivative_blocks ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X;
+  for (size_t i = 0; i < noutputs; ++i)
+    X.push_back(arma::randn(8 + i, 2));
+  size_t n = 8 * noutputs + 3;
+
+  // Lower triangular entries touch one block, low-rank ones at most a row
+  // and a column band.
+  for (size_t rank = 0; rank <= 2; rank += 2) {
+    gplib::multioutput_kernels::lmc_kernel K(2, noutputs);
+    K.set_rank(rank);
+    size_t n_coreg = rank == 0 ? 2 * noutputs * noutputs :
+      2 * noutputs * (rank + 1);
+    size_t max_blocks = rank == 0 ? 1 : 2 * noutputs - 1;
+    arma::mat W = arma::randn(n, n);
+    arma::vec W_diag = arma::randn(n);
+    for (size_t d = 0; d < K.n_params(); ++d) {
+      gplib::block_derivative D = K.derivate_blocks(d, X, X);
+      if (d < n_coreg)
+        BOOST_CHECK(D.blocks.size() <= max_blocks);
+      arma::mat dense = D.dense();
+      BOOST_CHECK_SMALL(D.contract(W) - arma::accu(W % dense), 1e-8);
+      gplib::block_derivative D_diag = K.derivate_blocks(d, X, X, true);
+      BOOST_CHECK_SMALL(D_diag.contract(W_diag, true) -
+          arma::dot(W_diag, D_diag.dense().diag()), 1e-8);
+    }
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t derivative blocks [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mo_lmc_shared_distances ) {
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t noutputs = 3;
+  vector<arma::mat> X, Y;
+  for (size_t i = 0; i < noutputs; ++i) {
+    X.push_back(arma::randn(10 + 2 * i, 2));
+    Y.push_back(arma::randn(4 + i, 2));
+  }
+
+  vector<shared_ptr<gplib::kernel_class>> shared, opaque;
+  vector<vector<double>> ker_par({{0.9, 1.2, 0.1}, {0.5, 0.4, 0.05}});
+  for (size_t q = 0; q < ker_par.size(); ++q) {
+    shared.push_back(
+        make_shared<gplib::kernels::squared_exponential>(ker_par[q]));
+    opaque.push_back(make_shared<opaque_kernel>(
+        make_shared<gplib::kernels::squared_exponential>(ker_par[q])));
+  }
+  vector<arma::mat> params(ker_par.size());
+  for (size_t q = 0; q < params.size(); ++q)
+    params[q] = arma::randu<arma::mat>(noutputs, noutputs);
+
+  gplib::multioutput_kernels::lmc_kernel K(shared, params);
+  gplib::multioutput_kernels::lmc_kernel K_opaque(opaque, params);
+  BOOST_CHECK(K.get_params() == K_opaque.get_params());
+
+  // The distances of each block are shared by the latent functions of one
+  // call, evaluating every kernel from the inputs gives the same results.
+  BOOST_CHECK(arma::approx_equal(K.eval(X, X), K_opaque.eval(X, X),
+        "absdiff", 1e-10));
+  BOOST_CHECK(arma::approx_equal(K.eval(X, Y), K_opaque.eval(X, Y),
+        "absdiff", 1e-10));
+
+  arma::mat W = arma::randn(K.eval(X, X).n_rows, K.eval(X, X).n_cols);
+  arma::mat W_cross = arma::randn(K.eval(X, Y).n_rows, K.eval(X, Y).n_cols);
+  vector<double> g = K.contract(W, X, X), g_opaque = K_opaque.contract(W, X, X);
+  vector<double> g_cross = K.contract(W_cross, X, Y),
+    g_cross_opaque = K_opaque.contract(W_cross, X, Y);
+  BOOST_CHECK_EQUAL(g.size(), g_opaque.size());
+  for (size_t d = 0; d < g.size() && d < g_opaque.size(); ++d) {
+    BOOST_CHECK_SMALL(g[d] - g_opaque[d], 1e-8);
+    BOOST_CHECK_SMALL(g_cross[d] - g_cross_opaque[d], 1e-8);
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  cout << "\033[32m\t shared distances [multioutput lmc_kernel] passed in "
+       << time_span.count() << " seconds. \033[0m\n";
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -45,4 +45,282 @@ BOOST_AUTO_TEST_CASE( mv_gauss_test ) {
 
 }
 
+BOOST_AUTO_TEST_CASE( mv_gauss_log_density ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t d = 5;
+  arma::mat A = arma::randn(d, d);
+  arma::mat cov = A * A.t() + d * arma::eye<arma::mat>(d, d);
+  arma::vec mean = arma::randn(d);
+  gplib::mv_gauss g(mean, cov);
+
+  arma::mat X = arma::randn(20, d);
+  arma::vec batch = g.log_densities(X);
+  BOOST_CHECK_EQUAL(batch.n_elem, X.n_rows);
+
+  arma::mat cov_inv = arma::inv_sympd(g.get_cov());
+  double log_det, sign;
+  arma::log_det(log_det, sign, g.get_cov());
+  for (size_t i = 0; i < X.n_rows; ++i) {
+    arma::vec x = X.row(i).t();
+    arma::vec diff = x - mean;
+    double expected = -0.5 * d * log(2 * gplib::pi) - 0.5 * log_det -
+                      0.5 * arma::dot(diff, cov_inv * diff);
+    BOOST_CHECK_CLOSE(g.log_density(x), expected, 1e-6);
+    BOOST_CHECK_CLOSE(batch(i), expected, 1e-6);
+  }
+  // Expressions go to the single point overload.
+  BOOST_CHECK_CLOSE(g.log_density(X.row(0).t() + 0.0), batch(0), 1e-6);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss log_density passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mv_gauss_conditional ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t d = 6;
+  arma::mat A = arma::randn(d, d);
+  arma::mat cov = A * A.t() + d * arma::eye<arma::mat>(d, d);
+  arma::vec mean = arma::randn(d);
+  gplib::mv_gauss g(mean, cov);
+
+  std::vector<bool> observed({true, false, true, true, false, false});
+  arma::uvec obs_ix({0, 2, 3}), hidden_ix({1, 4, 5});
+  cov = g.get_cov();
+  arma::mat gain = cov(hidden_ix, obs_ix) * arma::inv(cov(obs_ix, obs_ix));
+  arma::mat expected_cov = cov(hidden_ix, hidden_ix) - gain * cov(obs_ix, hidden_ix);
+
+  // The second iteration reuses the cached factorization.
+  for (int it = 0; it < 2; ++it) {
+    arma::vec x = arma::randn(d);
+    gplib::mv_gauss c = g.conditional(x, observed);
+    arma::vec expected_mean = mean(hidden_ix) + gain * (x(obs_ix) - mean(obs_ix));
+    arma::mat c_cov = c.get_cov();
+    arma::vec c_mean = c.get_mean();
+    for (size_t i = 0; i < hidden_ix.n_elem; ++i) {
+      BOOST_CHECK_CLOSE(c_mean(i), expected_mean(i), 1e-6);
+      for (size_t j = 0; j < hidden_ix.n_elem; ++j)
+        BOOST_CHECK_SMALL(c_cov(i, j) - expected_cov(i, j), 1e-8);
+    }
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss conditional passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mv_gauss_low_rank ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t d = 8, rank = 3;
+  arma::vec mean = arma::randn(d);
+  arma::vec diag = arma::randu(d) + 0.5;
+  arma::mat U = arma::randn(d, rank);
+  gplib::mv_gauss lr = gplib::mv_gauss::low_rank(mean, diag, U);
+  gplib::mv_gauss dense(mean, arma::diagmat(diag) + U * U.t());
+  BOOST_CHECK_EQUAL(lr.structure(), gplib::mv_gauss::LOW_RANK);
+
+  arma::mat X = arma::randn(10, d);
+  arma::vec lr_ld = lr.log_densities(X);
+  arma::vec dense_ld = dense.log_densities(X);
+  for (size_t i = 0; i < X.n_rows; ++i)
+    BOOST_CHECK_CLOSE(lr_ld(i), dense_ld(i), 1e-6);
+
+  std::vector<bool> observed({true, false, true, true, false, false, true, false});
+  arma::vec x = arma::randn(d);
+  gplib::mv_gauss lr_c = lr.conditional(x, observed);
+  gplib::mv_gauss dense_c = dense.conditional(x, observed);
+  BOOST_CHECK_EQUAL(lr_c.structure(), gplib::mv_gauss::LOW_RANK);
+  arma::mat lr_cov = lr_c.get_cov(), dense_cov = dense_c.get_cov();
+  arma::vec lr_mean = lr_c.get_mean(), dense_mean = dense_c.get_mean();
+  for (size_t i = 0; i < lr_mean.n_elem; ++i) {
+    BOOST_CHECK_SMALL(lr_mean(i) - dense_mean(i), 1e-8);
+    for (size_t j = 0; j < lr_mean.n_elem; ++j)
+      BOOST_CHECK_SMALL(lr_cov(i, j) - dense_cov(i, j), 1e-8);
+  }
+
+  gplib::mv_gauss lr_m = lr.marginalize_hidden(observed);
+  gplib::mv_gauss dense_m = dense.marginalize_hidden(observed);
+  arma::vec y = arma::randn(lr_m.dimension());
+  BOOST_CHECK_CLOSE(lr_m.log_density(y), dense_m.log_density(y), 1e-6);
+
+  gplib::mv_gauss diag_g = gplib::mv_gauss::diagonal(mean, diag);
+  gplib::mv_gauss diag_dense(mean, arma::diagmat(diag));
+  BOOST_CHECK_CLOSE(diag_g.log_density(x), diag_dense.log_density(x), 1e-6);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss low rank passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mv_gauss_concurrent_conditional ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t d = 8, rank = 3, n_calls = 16;
+  arma::vec mean = arma::randn(d);
+  arma::vec diag = arma::randu(d) + 0.5;
+  arma::mat U = arma::randn(d, rank);
+  std::vector<gplib::mv_gauss> dists({gplib::mv_gauss(mean,
+        arma::diagmat(diag) + U * U.t()),
+      gplib::mv_gauss::low_rank(mean, diag, U)});
+  std::vector<std::vector<bool>> masks({
+      {true, false, true, true, false, false, true, false},
+      {false, true, true, false, true, false, false, true}});
+  arma::mat x = arma::randn(d, n_calls);
+
+  // Alternating masks make the calls refactorize the shared cache while
+  // others read it, the results match the ones of a fresh copy.
+  for (size_t k = 0; k < dists.size(); ++k) {
+    std::vector<arma::vec> means(n_calls);
+    std::vector<arma::mat> covs(n_calls);
+    gplib::parallel_for(0, n_calls, [&](size_t c) {
+      gplib::mv_gauss cond = dists[k].conditional(x.col(c), masks[c % 2]);
+      means[c] = cond.get_mean();
+      covs[c] = cond.get_cov();
+    }, 4);
+    for (size_t c = 0; c < n_calls; ++c) {
+      gplib::mv_gauss fresh = dists[k];
+      gplib::mv_gauss cond = fresh.conditional(x.col(c), masks[c % 2]);
+      BOOST_CHECK(arma::approx_equal(means[c], cond.get_mean(), "absdiff",
+            1e-12));
+      BOOST_CHECK(arma::approx_equal(covs[c], cond.get_cov(), "absdiff",
+            1e-12));
+    }
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss concurrent conditional passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mv_gauss_stream_sample ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  const size_t d = 4;
+  arma::mat A = arma::randn(d, d);
+  arma::mat cov = A * A.t() + arma::eye<arma::mat>(d, d);
+  gplib::mv_gauss g(arma::randn(d), cov);
+
+  // Same stream, different number of threads -> same samples.
+  gplib::rng_stream r1(42, 7), r4(42, 7);
+  arma::mat s1 = g.sample(1000, r1, 1);
+  arma::mat s4 = g.sample(1000, r4, 4);
+  BOOST_CHECK_EQUAL(r1.position(), 1000u);
+  for (size_t i = 0; i < s1.n_rows; ++i)
+    for (size_t j = 0; j < s1.n_cols; ++j)
+      BOOST_CHECK_EQUAL(s1(i, j), s4(i, j));
+
+  // Drawing in two batches continues the stream.
+  gplib::rng_stream r2(42, 7);
+  arma::mat first = g.sample(300, r2, 2);
+  arma::mat second = g.sample(700, r2, 2);
+  for (size_t j = 0; j < d; ++j) {
+    BOOST_CHECK_CLOSE(first(299, j), s1(299, j), 1e-9);
+    BOOST_CHECK_CLOSE(second(0, j), s1(300, j), 1e-9);
+  }
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss stream sample passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( rng_stream_ids ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // The high bits of the seed and of the stream id give different streams.
+  const uint64_t high = uint64_t(1) << 32;
+  vector<gplib::rng_stream> streams({gplib::rng_stream(high, 0),
+      gplib::rng_stream(0, high), gplib::rng_stream(0, 0),
+      gplib::rng_stream(high, high)});
+  vector<arma::mat> values;
+  for (size_t k = 0; k < streams.size(); ++k)
+    values.push_back(streams[k].randu(4, 4));
+  for (size_t a = 0; a < values.size(); ++a)
+    for (size_t b = a + 1; b < values.size(); ++b)
+      BOOST_CHECK(arma::any(arma::vectorise(values[a] != values[b])));
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t rng_stream ids passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
+BOOST_AUTO_TEST_CASE( mv_gauss_jitter ) {
+
+  chrono::high_resolution_clock::time_point t1 =
+    chrono::high_resolution_clock::now();
+
+  // Rank one covariance, chol fails without jitter.
+  arma::vec u = {1.0, 2.0, 3.0};
+  arma::mat cov = u * u.t();
+  arma::mat R;
+  double jitter = gplib::robust_chol(cov, R);
+  BOOST_CHECK(jitter > 0);
+  BOOST_CHECK(arma::approx_equal(R.t() * R,
+        cov + jitter * arma::eye<arma::mat>(3, 3), "absdiff", 1e-8));
+
+  gplib::mv_gauss g(arma::zeros<arma::vec>(3), cov);
+  BOOST_CHECK_EQUAL(g.jitter(), jitter);
+  BOOST_CHECK(std::isfinite(g.log_density(u)));
+
+  // Positive definite matrices are not modified.
+  BOOST_CHECK_EQUAL(gplib::robust_chol(arma::eye<arma::mat>(3, 3), R), 0.0);
+
+  // Matrices that no jitter can fix raise factorization_error.
+  arma::mat bad = -arma::eye<arma::mat>(3, 3);
+  BOOST_CHECK_THROW(gplib::robust_chol(bad, R), gplib::factorization_error);
+
+  chrono::high_resolution_clock::time_point t2 =
+    chrono::high_resolution_clock::now();
+
+  chrono::duration<double> time_span =
+    chrono::duration_cast<chrono::duration<double>>(t2 - t1);
+
+  std::cout << "\033[32m\t mv_gauss jitter passed in "
+      << time_span.count() << " seconds. \033[0m\n";
+}
+
 BOOST_AUTO_TEST_SUITE_END()